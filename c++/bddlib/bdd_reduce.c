@@ -10,18 +10,18 @@
 
 #if defined(REDUCTION)
 
-static bddp bdd_reduce_rec(obdd_t* f, my_hash *h);
+static bddp bdd_reduce_rec(obdd_mgr* m, obdd_t f, my_hash *h);
 
 static uintmax_t recdepth = 0; //!< recursion depth
 
 
-bddp bdd_reduce(obdd_t* f)
+bddp bdd_reduce(obdd_mgr* m, obdd_t f)
 {
   my_hash *h = ht_create(0);
   ENSURE_TRUE_MSG(h != NULL, "hash table creation failed");
 
   assert(recdepth == 0);
-  bddp r = bdd_reduce_rec(f, h);
+  bddp r = bdd_reduce_rec(m, f, h);
   ENSURE_TRUE(r != BDD_NULL);
   assert(recdepth == 0);
 
@@ -29,20 +29,20 @@ bddp bdd_reduce(obdd_t* f)
   return r;
 }
 
-static bddp bdd_reduce_rec(obdd_t* f, my_hash *h)
+static bddp bdd_reduce_rec(obdd_mgr* m, obdd_t f, my_hash *h)
 {
-  if(f == obdd_top()) return bdd_top();
-  if(f == obdd_bot()) return bdd_bot();
+  if(f == obdd_top(m)) return bdd_top();
+  if(f == obdd_bot(m)) return bdd_bot();
 
   bddp r;
   if(ht_search((uintptr_t)f, (uintptr_t*)&r, h)) return r;
 
   INC_RECDEPTH(recdepth);
-  bddp lo = bdd_reduce_rec(f->lo, h);  
-  bddp hi = bdd_reduce_rec(f->hi, h);
+  bddp lo = bdd_reduce_rec(m, obdd_lo(m, f), h);  
+  bddp hi = bdd_reduce_rec(m, obdd_hi(m, f), h);
   DEC_RECDEPTH(recdepth);
 
-  r = bdd_node(obdd_label(f), lo, hi);
+  r = bdd_node(obdd_label(m, f), lo, hi);
   ENSURE_TRUE_MSG(r != BDD_NULL, "BDD operation failed");
 
   ht_insert((uintptr_t)f, (uintptr_t)r, h);
@@ -8,6 +8,6 @@
 #include "obdd.h"
 #include "bdd_interface.h"
 
-extern bddp bdd_reduce(obdd_t* f);
+extern bddp bdd_reduce(obdd_mgr* m, obdd_t f);
 #endif
 #endif /*BDD_REDUCE_H*/
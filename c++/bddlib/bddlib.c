@@ -1,17 +1,104 @@
+#include <string.h>
+
+#include "my_def.h"
 #include "solver.h"
 
-volatile sig_atomic_t eflag = 0;
-static void SIGINT_handler(int signum)
+bddctx* bddctx_new(void)
+{
+  bddctx* ctx = (bddctx*)malloc(sizeof(bddctx));
+  ENSURE_TRUE_MSG(ctx != NULL, "memory allocation failed");
+  memset(ctx, 0, sizeof(bddctx));
+  obdd_initialize(&ctx->obdd);
+  ctx->eflag = 0;
+  return ctx;
+}
+
+void bddctx_delete(bddctx* ctx)
+{
+  obdd_release(&ctx->obdd, 1);
+  trie_finalize(&ctx->trie);
+  free(ctx);
+}
+
+void release_obdd_storage(bddctx* ctx, int final)
+{
+  obdd_release(&ctx->obdd, final);
+}
+
+struct bdd_cache_stats {
+  uint64_t lookups;
+  uint64_t hits;
+  uint64_t evictions;
+  uint64_t max_bytes;
+};
+
+void get_cache_stats(solver* s, struct bdd_cache_stats* stats)
+{
+  stats->lookups   = s->stats.ncachelookup;
+  stats->hits      = s->stats.ncachehits;
+  stats->evictions = s->stats.ncacheevictions;
+  stats->max_bytes = s->stats.maxcachebytes;
+}
+
+obdd_t mark_obdd_storage(bddctx* ctx)
+{
+  return obdd_mark(&ctx->obdd);
+}
+
+void rewind_obdd_storage(bddctx* ctx, obdd_t mark)
 {
-	eflag = 1;
+  obdd_rewind(&ctx->obdd, mark);
+}
+
+obdd_t conjoin_bdd(solver* s, obdd_t p, int* begin, int* end, int atleast, int atmost)
+{
+  int nlits = (int)(end - begin);
+  int* lits = (int*)malloc(sizeof(int)*(nlits > 0 ? nlits : 1));
+  ENSURE_TRUE_MSG(lits != NULL, "memory allocation failed");
+  for(int i = 0; i < nlits; i++)
+    lits[i] = lit_sign(begin[i]) ? -(lit_var(begin[i])+1) : lit_var(begin[i])+1;
+
+  obdd_t r = obdd_and_card(&s->ctx->obdd, s->size, p, lits, nlits, atleast, atmost);
+  free(lits);
+  return r;
+}
+
+obdd_t filter_lex_bdd(solver* s, obdd_t p, int* x, int* y, int len)
+{
+  int* lits = (int*)malloc(sizeof(int)*2*(len > 0 ? len : 1));
+  ENSURE_TRUE_MSG(lits != NULL, "memory allocation failed");
+  for(int i = 0; i < len; i++)
+    {
+      lits[i]     = lit_sign(x[i]) ? -(lit_var(x[i])+1) : lit_var(x[i])+1;
+      lits[len+i] = lit_sign(y[i]) ? -(lit_var(y[i])+1) : lit_var(y[i])+1;
+    }
+
+  obdd_t r = obdd_lexleq(&s->ctx->obdd, s->size, p, lits, lits + len, len);
+  free(lits);
+  return r;
+}
+
+uint64_t count_bdd(solver* s, obdd_t p, uint64_t* hi)
+{
+  obdd_count_t c = obdd_nsols_wide(&s->ctx->obdd, s->size, p);
+  *hi = c.hi;
+  return c.lo;
+}
+
+// The number of models of p by obdd_nsols (saturated at INTPTR_MAX),
+// which is not declared in bddlib.h: test_bdd checks count_bdd by it.
+intptr_t count_bdd_narrow(solver* s, obdd_t p)
+{
+  return obdd_nsols(&s->ctx->obdd, s->size, p);
 }
 
 
 struct bdd_data {
   int n;
   int * a;
-  obdd_t ** b;
-  obdd_t * p;
+  obdd_t * b;
+  int * d;
+  obdd_t p;
   int s;
   int t;
   int done;
@@ -19,13 +106,14 @@ struct bdd_data {
   int first_time;
 };
 
-obdd_t * get_root(solver * s)
+obdd_t get_root(solver * s)
 {
   return s->root;
 }
 
-void decompose_bdd(struct bdd_data * data)
+void decompose_bdd(bddctx * ctx, struct bdd_data * data)
 {
+  obdd_mgr * m = &ctx->obdd;
   data->sol_found = 0;
 
   do {
@@ -40,17 +128,29 @@ void decompose_bdd(struct bdd_data * data)
 	data->p = data->b[--data->t]; 
 	while(data->a[--data->s] > 0) ;
 	data->a[data->s] = abs(data->a[data->s]); data->s++;
-	data->p = data->p->hi;
+	data->p = obdd_hi(m, data->p);
       }
     else
       data->first_time = 0;	
     
-    while(!(data->p == obdd_bot() || data->p == obdd_top())) {
+    while(!(data->p == OBDD_BOT || data->p == OBDD_TOP)) {
+      obdd_t lo = obdd_lo(m, data->p);
+      if(data->d != NULL)
+	{
+	  data->d[data->s] = lo == obdd_hi(m, data->p);
+	  if(data->d[data->s])
+	    {
+	      // not pushed to b, so that the hi arc is never taken
+	      data->a[data->s++] = obdd_label(m, data->p);
+	      data->p = lo;
+	      continue;
+	    }
+	}
       data->b[data->t++]  = data->p;
-      data->a[data->s++]  = -(data->p->v);
-      data->p       = data->p->lo;
+      data->a[data->s++]  = -obdd_label(m, data->p);
+      data->p       = lo;
     }
-    if(data->p == obdd_top())
+    if(data->p == OBDD_TOP)
       {
 	data->sol_found = 1;
       }
@@ -1,28 +1,46 @@
 #ifndef _BDDLIB_H
 #define _BDDLIB_H
 
+#include <stdint.h>
+#include <stddef.h>
+
+struct bddctx_t;
+typedef struct bddctx_t bddctx;
+
 struct solver_t;
 typedef struct solver_t bddsolver;
 
-struct obdd_st;
-typedef struct obdd_st obdd_t;
+// obdd nodes are indices into the node arrays of their context (see obdd.h)
+typedef uint32_t obdd_t;
+
+// A context holds the obdd nodes and caches of its solvers. Different
+// contexts can be used from different threads.
+extern bddctx* bddctx_new(void);
+extern void bddctx_delete(bddctx* ctx);
 
-extern bddsolver* solver_new(void);
+extern bddsolver* solver_new(bddctx* ctx);
 extern void    solver_delete(bddsolver* s);
 extern int    solver_addclause(bddsolver* s, int* begin, int* end);
 extern int    solver_solve(bddsolver* s, int* begin, int* end);
 extern int    solver_simplify(bddsolver* s);
 extern void solver_reset(bddsolver * s);
-extern obdd_t * get_root(bddsolver *s);
+extern obdd_t get_root(bddsolver *s);
 extern void solver_setpersistent(bddsolver * s);
 extern int solver_npersistent(bddsolver * s);
+// Caches of the levels are evicted whenever they take more than bytes
+// (0, which is the default, means no limit)
+extern void solver_setcachebudget(bddsolver * s, size_t bytes);
 
 
 struct bdd_data {
   int n;
   int * a;
-  obdd_t ** b;
-  obdd_t * p;
+  obdd_t * b;
+  // Flags of the positions of a that are don't-cares (the lo and hi
+  // arcs lead to the same node, which is visited once), or NULL if
+  // each path is decomposed into single solutions
+  int * d;
+  obdd_t p;
   int s;
   int t;
   int done;
@@ -30,11 +48,37 @@ struct bdd_data {
   int first_time;
 };
 
-extern void decompose_bdd(bdd_data * data);
+extern void decompose_bdd(bddctx * ctx, bdd_data * data);
+
+extern void release_obdd_storage(bddctx * ctx, int final);
+
+// Cache statistics of the last compilation of the solver s
+struct bdd_cache_stats {
+  uint64_t lookups;
+  uint64_t hits;
+  uint64_t evictions;
+  uint64_t max_bytes;
+};
+
+extern void get_cache_stats(bddsolver * s, bdd_cache_stats * stats);
+
+// The nodes obtained after mark_obdd_storage are deleted by rewind_obdd_storage.
+extern obdd_t mark_obdd_storage(bddctx * ctx);
+extern void rewind_obdd_storage(bddctx * ctx, obdd_t mark);
+
+// The obdd p of the solver s (p is not changed) conjoined with the
+// constraint that from atleast to atmost of the literals are true.
+// Call mark_obdd_storage after solving and before conjoining.
+extern obdd_t conjoin_bdd(bddsolver * s, obdd_t p, int* begin, int* end, int atleast, int atmost);
 
-extern void add_to_obdd_node_storage(obdd_t * freelist);
+// The obdd p (which is not changed) without the models in which the
+// values of x[0],...,x[len-1] are lexicographically greater than the
+// ones of y. Call mark_obdd_storage before, as for conjoin_bdd.
+extern obdd_t filter_lex_bdd(bddsolver * s, obdd_t p, int* x, int* y, int len);
 
-extern void release_obdd_storage(int final);
+// The number of models of the obdd p of the solver s, which is
+// *hi * 2^64 + the returned value (saturated only at 2^128 - 1).
+extern uint64_t count_bdd(bddsolver * s, obdd_t p, uint64_t* hi);
 
 
 #endif // _BDDLIB_H
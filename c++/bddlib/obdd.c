@@ -6,153 +6,268 @@
 #include <stdint.h>
 #include <assert.h>
 #include <math.h>
+#include <string.h>
 
 #include "my_def.h"
 #include "obdd.h"
 #include "vec.h"
 
 
-static const int    initlen   = 65536;
-static obdd_t*      freelist  = NULL;
+static const obdd_t initlen   = 65536;
+static const int    trim_interval = 64; // releases between two trims of unused nodes
 
-static uintmax_t nnodes = 0; // the total number of nodes that have been created so far.
 
-obdd_t* top_node = NULL;
-obdd_t* bot_node = NULL;
+void obdd_initialize(obdd_mgr* m)
+{
+  m->label = NULL;
+  m->lo = NULL;
+  m->hi = NULL;
+  m->aux = NULL;
+  m->pos = OBDD_FIRST;
+  m->cap = 0;
+  m->hwm = 0;
+  m->nreleases = 0;
+  m->freelist = OBDD_NULL;
+  m->nnodes = 0; 
+  m->utable = NULL;
+  m->ucap = 0;
+}
 
-vecp flist_vec;
 
-void add_to_obdd_node_storage(obdd_t * freelist)
+// Reallocate the arrays of m so that they hold cap nodes.
+static void obdd_resize(obdd_mgr* m, obdd_t cap)
 {
-  if(flist_vec.ptr == NULL)
-    {
-      vecp_new(&flist_vec);
+  assert(cap >= m->pos);
+  m->label = (int*)realloc(m->label, sizeof(int)*cap);
+  m->lo    = (obdd_t*)realloc(m->lo, sizeof(obdd_t)*cap);
+  m->hi    = (obdd_t*)realloc(m->hi, sizeof(obdd_t)*cap);
+  m->aux   = (obdd_t*)realloc(m->aux, sizeof(obdd_t)*cap);
+  ENSURE_TRUE_MSG(m->label != NULL && m->lo != NULL && m->hi != NULL && m->aux != NULL, "memory allocation failed");
+  if (m->cap == 0) {
+    for (obdd_t p = OBDD_NULL; p < OBDD_FIRST; p++) {
+      m->label[p] = p == OBDD_NULL? 0: INT_MAX;
+      m->lo[p]    = OBDD_NULL;
+      m->hi[p]    = OBDD_NULL;
+      m->aux[p]   = OBDD_NULL;
     }
-  vecp_push(&flist_vec, freelist);
+  }
+  m->cap = cap;
 }
 
-void release_obdd_storage(int final)
-{
-  if(flist_vec.ptr == NULL)
-    return;
-  
-  void ** begin = vecp_begin(&flist_vec);
-  int size = vecp_size(&flist_vec);
-  for(unsigned i = 0; i < size; i++)
-    free(begin[i]);
 
-  if(final == 0)
-    vecp_resize(&flist_vec, 0);
+void obdd_release(obdd_mgr* m, int final)
+{
+  if (final == 0)
+    {
+      // keep the arrays, but shrink them to the most nodes needed lately
+      if(m->pos > m->hwm)
+	m->hwm = m->pos;
+      if(++m->nreleases >= trim_interval)
+	{
+	  obdd_t cap = m->hwm > initlen? m->hwm: initlen;
+	  if(m->cap > cap)
+	    {
+	      m->pos = OBDD_FIRST;
+	      obdd_resize(m, cap);
+	    }
+	  m->hwm = 0;
+	  m->nreleases = 0;
+	}
+    }
   else
     {
-      vecp_delete(&flist_vec);
-      flist_vec.ptr = NULL;
-      flist_vec.size = 0;
-      flist_vec.cap = 0;
+      free(m->label);
+      free(m->lo);
+      free(m->hi);
+      free(m->aux);
+      free(m->utable);
+      m->label = NULL;
+      m->lo = NULL;
+      m->hi = NULL;
+      m->aux = NULL;
+      m->cap = 0;
+      m->utable = NULL;
+      m->ucap = 0;
     }
-  freelist = NULL;
-  nnodes = 0;
-  top_node = NULL;
-  bot_node = NULL;
+  m->pos = OBDD_FIRST;
+  m->freelist = OBDD_NULL;
+  m->nnodes = 0;
 }
 
 
-uintmax_t obdd_nnodes(void)
+uintmax_t obdd_nnodes(obdd_mgr* m)
 {
-    return nnodes;
+    return m->nnodes;
 }
 
 
-obdd_t* obdd_node(int v, obdd_t* lo, obdd_t* hi)
+obdd_t obdd_node(obdd_mgr* m, int v, obdd_t lo, obdd_t hi)
 {
     assert(v > 0);
-    if (freelist == NULL) {	  
-        freelist = (obdd_t*)malloc(sizeof(obdd_t)*initlen);
-	add_to_obdd_node_storage(freelist);
-        ENSURE_TRUE_MSG(freelist != NULL, "memory allocation failed");
-        for (int i = 1; i < initlen; i++)
-            freelist[i-1].aux = (intptr_t)(freelist+i);
-        freelist[initlen-1].aux = (intptr_t)NULL;
+    obdd_t new;
+    if (m->freelist != OBDD_NULL) {
+        new = m->freelist;
+        m->freelist  = m->aux[new];
+    } else {
+        if (m->pos >= m->cap) {
+            ENSURE_TRUE_MSG(m->cap <= UINT32_MAX/2, "too many obdd nodes");
+            obdd_resize(m, m->cap == 0? initlen: 2*m->cap);
+        }
+        new = m->pos++;
     }
-    obdd_t* new = freelist;
-    freelist  = (obdd_t*)freelist->aux;
-    obdd_setlabel(v, new);
-    new->lo  = lo;
-    new->hi  = hi;
-    new->aux = 0;
-    nnodes++;
+    m->label[new] = v;
+    m->lo[new]    = lo;
+    m->hi[new]    = hi;
+    m->aux[new]   = OBDD_NULL;
+    m->nnodes++;
 
     return new;
 }
 
 
-static void obdd_free(obdd_t* p)
+static void obdd_free(obdd_mgr* m, obdd_t p)
 {
-    p->aux = (intptr_t)freelist;
-    freelist = p;
-    assert(nnodes > 0);
-    nnodes--;
+    m->label[p] = 0;
+    m->aux[p]   = m->freelist;
+    m->freelist = p;
+    assert(m->nnodes > 0);
+    m->nnodes--;
 }
 
 
-uintmax_t obdd_complete(obdd_t* p)
+uintmax_t obdd_complete(obdd_mgr* m, obdd_t p)
 {
-    obdd_t* dummy  = obdd_node(INT_MAX, NULL, NULL);
-    obdd_t* tail  = dummy;
-    obdd_t* stack = NULL; 
-
-    while (1) {
-        while (p != NULL && !obdd_const(p) && p->v > 0) {
-            p->v    *= -1;
-            p->aux   = (intptr_t)stack;
-            stack    = p;
-            tail->nx = p;
-            tail     = p;
-            p        = p->lo;
-        }
-        if ((p = stack) == NULL)
-            break;
-        stack = (obdd_t*)stack->aux;
-        p = p->hi;
-    }
-
-    tail->nx = NULL;
-    p = dummy->nx;
-    obdd_free(dummy);
-
+    (void)p;
     uintmax_t size = 0;
-    for (; p != NULL; p = p->nx) {
-        if (p->lo == NULL)
-            p->lo = obdd_bot();
-        if (p->hi == NULL)
-            p->hi = obdd_bot();
-        assert(p->v < 0);
-        p->v   *= -1;
+    for (obdd_t s = OBDD_FIRST; s < m->pos; s++) {
+        if (m->label[s] == 0)
+            continue;
+        if (m->lo[s] == OBDD_NULL)
+            m->lo[s] = OBDD_BOT;
+        if (m->hi[s] == OBDD_NULL)
+            m->hi[s] = OBDD_BOT;
         size++;
     }
+    assert(size == m->nnodes);
 
     return size;
 }
 
 
-void obdd_delete_all(obdd_t* p)
+void obdd_delete_all(obdd_mgr* m, obdd_t p)
+{
+    (void)p;
+    m->pos      = OBDD_FIRST;
+    m->freelist = OBDD_NULL;
+    m->nnodes   = 0;
+}
+
+
+obdd_t obdd_mark(obdd_mgr* m)
+{
+    m->freelist = OBDD_NULL;
+    return m->pos;
+}
+
+
+void obdd_rewind(obdd_mgr* m, obdd_t mark)
+{
+    assert(m->freelist == OBDD_NULL && mark <= m->pos);
+    m->nnodes -= m->pos - mark;
+    m->pos     = mark;
+}
+
+
+// Link the nodes of m by aux field for each label, and return the array of first nodes indexed by labels.
+static obdd_t* obdd_bucket(obdd_mgr* m, int n)
 {
-    while (p != NULL) {
-        obdd_t* nx = p->nx;
-        p->nx = NULL;
-        obdd_free(p);
-        p = nx;
+    obdd_t* list = (obdd_t*)malloc(sizeof(obdd_t)*(n+1));
+    ENSURE_TRUE_MSG(list != NULL, "memory allocation failed");
+    for (int i = 0; i <= n; i++)
+        list[i] = OBDD_NULL;
+
+    for (obdd_t s = OBDD_FIRST; s < m->pos; s++) {
+        int v = m->label[s];
+        if (v == 0)
+            continue;
+        assert(v <= n);
+        m->aux[s] = list[v];
+        list[v]   = s;
     }
+
+    return list;
 }
 
 
-uintmax_t obdd_size(obdd_t* p)
+static inline size_t obdd_hash(int v, obdd_t lo, obdd_t hi)
 {
-    uintmax_t n = 0;  
-    for (; p != NULL; p = p->nx)
-        n++;
+    uint64_t h = (uint64_t)v;
+    h = (h * 0x9e3779b97f4a7c15ULL) ^ lo;
+    h = (h * 0x9e3779b97f4a7c15ULL) ^ hi;
+    return (size_t)(h ^ (h >> 31));
+}
+
+
+uintmax_t obdd_share(obdd_mgr* m, int n, obdd_t p)
+{
+    if (obdd_const(m, p))
+        return 0;
+
+    obdd_t* list = obdd_bucket(m, n);
+
+    // at most half of the slots are used, and the table is only cleared up to cap.
+    size_t cap = 1024;
+    while (cap < 2*m->nnodes)
+        cap <<= 1;
+    if (cap > m->ucap) {
+        free(m->utable);
+        m->utable = (obdd_t*)malloc(sizeof(obdd_t)*cap);
+        ENSURE_TRUE_MSG(m->utable != NULL, "memory allocation failed");
+        m->ucap = cap;
+    }
+    obdd_t* table = m->utable;
+    memset(table, 0, sizeof(obdd_t)*cap);
+
+    // children have larger labels, so their representatives are already in their aux fields.
+    for (int i = n; i > 0; i--) {
+        for (obdd_t s = list[i]; s != OBDD_NULL;) {
+            obdd_t nx = m->aux[s];
+            if (!obdd_const(m, m->lo[s]))
+                m->lo[s] = m->aux[m->lo[s]];
+            if (!obdd_const(m, m->hi[s]))
+                m->hi[s] = m->aux[m->hi[s]];
+
+            size_t h = obdd_hash(i, m->lo[s], m->hi[s]) & (cap-1);
+            obdd_t r;
+            while ((r = table[h]) != OBDD_NULL && (m->label[r] != i || m->lo[r] != m->lo[s] || m->hi[r] != m->hi[s]))
+                h = (h+1) & (cap-1);
+            if (r == OBDD_NULL)
+                table[h] = r = s;
+            m->aux[s] = r;
+            s = nx;
+        }
+    }
 
-    return n;
+    // p is the only node with its label, so it is kept; free the others that were merged.
+    for (obdd_t s = OBDD_FIRST; s < m->pos; s++) {
+        if (m->label[s] == 0)
+            continue;
+        if (m->aux[s] != s)
+            obdd_free(m, s);
+        else
+            m->aux[s] = OBDD_NULL;
+    }
+
+    free(list);
+
+    return m->nnodes;
+}
+
+
+uintmax_t obdd_size(obdd_mgr* m, obdd_t p)
+{
+    (void)p;
+    return m->nnodes;
 }
 
 /* \brief multiply x by 2^k.
@@ -171,105 +286,156 @@ static inline uintptr_t my_mul_2exp(uintptr_t x, int k)
     return x;
 }
 
-intptr_t obdd_nsols(int n, obdd_t* p)
+
+// label of p, where terminal nodes and missing children are regarded as being at level n+1.
+static inline int obdd_level(obdd_mgr* m, int n, obdd_t p)
 {
-    obdd_t** list = (obdd_t**)malloc(sizeof(obdd_t*)*(n+1));
-    ENSURE_TRUE_MSG(list != NULL, "memory allocation failed");
-    for (int i = 0; i <= n; i++)
-        list[i] = NULL;
+    return p < OBDD_FIRST? n+1: m->label[p];
+}
 
-    for (obdd_t* s = p; s != NULL; s = s->nx) {
-        int v   = obdd_label(s);
-        assert(v <= n);
-        s->aux  = (intptr_t)list[v];
-        list[v] = s;
-    }
 
-    obdd_top()->aux = 1;
-    obdd_bot()->aux = 0;
-    uintptr_t result;
-    for (int i = n; i > 0; i--) {
-        for (obdd_t* s = list[i]; s != NULL;) {
-            obdd_t* nx = (obdd_t*)s->aux;
-            int j = obdd_const(s->hi)? n+1: obdd_label(s->hi);
-            result = my_mul_2exp((uintptr_t)s->hi->aux, j-i-1);
-            intptr_t c1 = result > INTPTR_MAX? INTPTR_MAX: (intptr_t)result;
+intptr_t obdd_nsols(obdd_mgr* m, int n, obdd_t p)
+{
+    if (p < OBDD_FIRST) {
+        uintptr_t result = p == OBDD_TOP? my_mul_2exp(1, n): 0;
+        return result > INTPTR_MAX? INTPTR_MAX: (intptr_t)result;
+    }
 
-            j = obdd_const(s->lo)? n+1: obdd_label(s->lo);
-            result = my_mul_2exp((uintptr_t)s->lo->aux, j-i-1);
-            intptr_t c2 = result > INTPTR_MAX? INTPTR_MAX: (intptr_t)result;
+    obdd_t* list = obdd_bucket(m, n);
+    uintptr_t* c = (uintptr_t*)malloc(sizeof(uintptr_t)*m->pos);
+    ENSURE_TRUE_MSG(c != NULL, "memory allocation failed");
 
-            s->aux = c1 <= INTPTR_MAX -c2? c1+c2: INTPTR_MAX;
-            s = nx;
+    c[OBDD_NULL] = 0;
+    c[OBDD_BOT]  = 0;
+    c[OBDD_TOP]  = 1;
+    for (int i = n; i > 0; i--) {
+        for (obdd_t s = list[i]; s != OBDD_NULL; s = m->aux[s]) {
+            obdd_t hi = m->hi[s];
+            obdd_t lo = m->lo[s];
+            uintptr_t c1 = my_mul_2exp(c[hi], obdd_level(m, n, hi)-i-1);
+            uintptr_t c2 = my_mul_2exp(c[lo], obdd_level(m, n, lo)-i-1);
+            c[s] = c1 <= UINTPTR_MAX - c2? c1+c2: UINTPTR_MAX;
         }
     }
 
-    result = my_mul_2exp((uintptr_t)p->aux, obdd_label(p)-1);
-    result = result > INTPTR_MAX? INTPTR_MAX: (intptr_t)result;
+    uintptr_t result = my_mul_2exp(c[p], m->label[p]-1);
+    result = result > INTPTR_MAX? INTPTR_MAX: result;
 
+    free(c);
     free(list);
 
+    return (intptr_t)result;
+}
+
+
+static const obdd_count_t count_max = { UINT64_MAX, UINT64_MAX };
+
+static inline obdd_count_t my_add_wide(obdd_count_t x, obdd_count_t y)
+{
+    obdd_count_t r;
+    r.lo = x.lo + y.lo;
+    r.hi = x.hi + y.hi + (r.lo < x.lo);
+    if (r.hi < x.hi || (r.hi == x.hi && r.lo < x.lo))
+        return count_max;
+    return r;
+}
+
+static inline obdd_count_t my_mul_2exp_wide(obdd_count_t x, int k)
+{
+    if (k == 0 || (x.hi == 0 && x.lo == 0))
+        return x;
+    if (k >= 128)
+        return count_max;
+
+    obdd_count_t r;
+    if (k >= 64) {
+        if (x.hi != 0 || (k > 64 && (x.lo >> (128-k)) != 0))
+            return count_max;
+        r.hi = x.lo << (k-64);
+        r.lo = 0;
+    } else {
+        if ((x.hi >> (64-k)) != 0)
+            return count_max;
+        r.hi = (x.hi << k) | (x.lo >> (64-k));
+        r.lo = x.lo << k;
+    }
+    return r;
+}
+
+// number of solutions of p over the variables from the label of p to n, where c[p] is valid if done[p] is set.
+static obdd_count_t obdd_nsols_wide_rec(obdd_mgr* m, int n, obdd_t p, obdd_count_t* c, unsigned char* done)
+{
+    if (p < OBDD_FIRST) {
+        obdd_count_t r = { 0, p == OBDD_TOP? 1: 0 };
+        return r;
+    }
+    if (done[p])
+        return c[p];
+
+    const int i = m->label[p];
+    obdd_t hi = m->hi[p];
+    obdd_t lo = m->lo[p];
+    obdd_count_t c1 = my_mul_2exp_wide(obdd_nsols_wide_rec(m, n, hi, c, done), obdd_level(m, n, hi)-i-1);
+    obdd_count_t c2 = my_mul_2exp_wide(obdd_nsols_wide_rec(m, n, lo, c, done), obdd_level(m, n, lo)-i-1);
+    c[p]    = my_add_wide(c1, c2);
+    done[p] = 1;
+    return c[p];
+}
+
+
+obdd_count_t obdd_nsols_wide(obdd_mgr* m, int n, obdd_t p)
+{
+    if (p < OBDD_FIRST) {
+        obdd_count_t r = { 0, p == OBDD_TOP? 1: 0 };
+        return my_mul_2exp_wide(r, n);
+    }
+
+    obdd_count_t* c = (obdd_count_t*)malloc(sizeof(obdd_count_t)*m->pos);
+    unsigned char* done = (unsigned char*)calloc(m->pos, sizeof(unsigned char));
+    ENSURE_TRUE_MSG(c != NULL && done != NULL, "memory allocation failed");
+
+    obdd_count_t result = my_mul_2exp_wide(obdd_nsols_wide_rec(m, n, p, c, done), m->label[p]-1);
+
+    free(c);
+    free(done);
+
     return result;
 }
 
 
 #ifdef GMP
-void obdd_nsols_gmp(mpz_t result, int n, obdd_t* p)
+void obdd_nsols_gmp(obdd_mgr* m, mpz_t result, int n, obdd_t p)
 {
-    obdd_t** list = (obdd_t**)malloc(sizeof(obdd_t*)*(n+1));
-    ENSURE_TRUE_MSG(list != NULL, "memory allocation failed");
-    for (int i = 0; i <= n; i++)
-        list[i] = NULL;
-
-    int m = 0;
-    for (obdd_t* s = p; s != NULL; s = s->nx) {
-        int v   = obdd_label(s);
-        s->aux  = (intptr_t)list[v];
-        list[v] = s;
-        m++;
+    if (p < OBDD_FIRST) {
+        mpz_set_ui(result, p == OBDD_TOP? 1: 0);
+        mpz_mul_2exp(result, result, n);
+        return;
     }
 
-    m += 2; // include terminal nodes.
-    const int size = m;
-    mpz_t *a = (mpz_t*)malloc(sizeof(mpz_t)*m);
+    obdd_t* list = obdd_bucket(m, n);
+    const obdd_t size = m->pos;
+    mpz_t *a = (mpz_t*)malloc(sizeof(mpz_t)*size);
     ENSURE_TRUE_MSG(a != NULL, "memory allocation failed");
-    for (int i = 0; i < m; i++) 
+    for (obdd_t i = 0; i < size; i++) 
         mpz_init(a[i]);
+    mpz_set_ui(a[OBDD_TOP],1);
 
-    assert(m > 0);
-    obdd_top()->aux = (intptr_t)--m;
-    mpz_set_ui(a[m],1);
-    assert(m > 0);
-    obdd_bot()->aux = (intptr_t)--m;
-    mpz_set_ui(a[m],0);
-
+    mpz_t t;
+    mpz_init(t);
     for (int i = n; i > 0; i--) {
-        for (obdd_t* s = list[i]; s != NULL;) {
-            obdd_t* nx = (obdd_t*)s->aux;
-            int j = obdd_const(s->hi)? n+1: obdd_label(s->hi);
-            intptr_t m1 = s->hi->aux;
-            if (j-i-1 > 0)
-                mpz_mul_2exp(a[m1],a[m1],j-i-1);
-
-            j = obdd_const(s->lo)? n+1: obdd_label(s->lo);
-            intptr_t m2 = s->lo->aux;
-            if (j-i-1 > 0)
-                mpz_mul_2exp(a[m2],a[m2],j-i-1);
-
-            assert(m > 0);
-            s->aux = (intptr_t)--m;
-            mpz_add(a[m], a[m1], a[m2]);
-            s = nx;
+        for (obdd_t s = list[i]; s != OBDD_NULL; s = m->aux[s]) {
+            obdd_t hi = m->hi[s];
+            obdd_t lo = m->lo[s];
+            mpz_mul_2exp(a[s], a[hi], obdd_level(m, n, hi)-i-1);
+            mpz_mul_2exp(t, a[lo], obdd_level(m, n, lo)-i-1);
+            mpz_add(a[s], a[s], t);
         }
     }
-    assert(m == 0);
+    mpz_clear(t);
 
-    m = p->aux; 
-    if(obdd_label(p)-1 > 0)
-        mpz_mul_2exp(a[m],a[m],obdd_label(p)-1);
-    mpz_set(result, a[m]);
+    mpz_mul_2exp(result, a[p], m->label[p]-1);
 
-    for (int i = 0; i < size; i++)
+    for (obdd_t i = 0; i < size; i++)
         mpz_clear(a[i]);
     free(list);
     free(a);
@@ -277,46 +443,35 @@ void obdd_nsols_gmp(mpz_t result, int n, obdd_t* p)
 #endif
 
 
-int obdd_to_dot(int n, obdd_t* p, FILE *out)
+int obdd_to_dot(obdd_mgr* m, int n, obdd_t p, FILE *out)
 { 
-    if(obdd_const(p)) {
+    if(obdd_const(m, p)) {
         ENSURE_TRUE_WARN(0, "invalid input");
         return ST_FAILURE;
     }
 
-    obdd_t** list = (obdd_t**)malloc(sizeof(obdd_t*)*(n+1));
-    ENSURE_TRUE_MSG(list != NULL, "memory allocation failed");
-    for (int i = 0; i <= n; i++)
-        list[i] = NULL;
-
-    for (obdd_t* s = p; s != NULL; s = s->nx) {
-        int v   = obdd_label(s);
-        s->aux  = (intptr_t)list[v];
-        list[v] = s;
-    }
+    obdd_t* list = obdd_bucket(m, n);
 
     int res = fseek(out, 0L, SEEK_SET);
     ENSURE_SUCCESS(res);
 
     fprintf(out, "digraph obdd {\n");
-    fprintf(out, "{rank = same; %jd %jd}\n", (intptr_t)obdd_top(), (intptr_t)obdd_bot());
+    fprintf(out, "{rank = same; %u %u}\n", (unsigned)OBDD_TOP, (unsigned)OBDD_BOT);
     for (int i = 1; i <= n; i++) {
         fprintf(out, "{rank = same;");
-        for (obdd_t* s = list[i]; s != NULL; s = (obdd_t*)s->aux)
-            fprintf(out, " %jd", (intptr_t)s);
+        for (obdd_t s = list[i]; s != OBDD_NULL; s = m->aux[s])
+            fprintf(out, " %u", (unsigned)s);
         fprintf(out, "}\n");
     }
     for (int i = n; i > 0; i--) {
-        for (obdd_t* s = list[i]; s != NULL;) {
-            obdd_t* t = (obdd_t*)s->aux;
-            fprintf(out, "%jd [label = %d];\n",           (intptr_t)s, i);
-            fprintf(out, "%jd -> %jd ;\n",                 (intptr_t)s, (intptr_t)s->hi);
-            fprintf(out, "%jd -> %jd [style = dotted];\n", (intptr_t)s, (intptr_t)s->lo);
-            s = t;
+        for (obdd_t s = list[i]; s != OBDD_NULL; s = m->aux[s]) {
+            fprintf(out, "%u [label = %d];\n",           (unsigned)s, i);
+            fprintf(out, "%u -> %u ;\n",                 (unsigned)s, (unsigned)m->hi[s]);
+            fprintf(out, "%u -> %u [style = dotted];\n", (unsigned)s, (unsigned)m->lo[s]);
         }
     }
-    fprintf(out, "%jd [label = 1,shape=box];\n", (intptr_t)obdd_top());
-    fprintf(out, "%jd [label = 0,shape=box];\n", (intptr_t)obdd_bot());
+    fprintf(out, "%u [label = 1,shape=box];\n", (unsigned)OBDD_TOP);
+    fprintf(out, "%u [label = 0,shape=box];\n", (unsigned)OBDD_BOT);
     fprintf(out, "}\n");
 
     free(list);
@@ -326,7 +481,7 @@ int obdd_to_dot(int n, obdd_t* p, FILE *out)
 
 
 // Decompose bdd into satisfying assignments.
-static uintptr_t obdd_decompose_main(FILE *out, int n, obdd_t* p, uintptr_t (*func)(FILE *, int, int, int*))
+static uintptr_t obdd_decompose_main(obdd_mgr* m, FILE *out, int n, obdd_t p, uintptr_t (*func)(FILE *, int, int, int*))
 {
   uintptr_t total   = 0;  // total number of total solutions
 
@@ -334,19 +489,19 @@ static uintptr_t obdd_decompose_main(FILE *out, int n, obdd_t* p, uintptr_t (*fu
   ENSURE_TRUE_MSG(a != NULL, "memory allocation failed");
   for(int i = 0; i <= n; i++) a[i] = 0;
 
-  obdd_t** b = (obdd_t**)malloc(sizeof(obdd_t*)*(n+1));
+  obdd_t* b = (obdd_t*)malloc(sizeof(obdd_t)*(n+1));
   ENSURE_TRUE_MSG(b != NULL, "memory allocation failed");
-  for(int i = 0; i <= n; i++) b[i] = NULL;
+  for(int i = 0; i <= n; i++) b[i] = OBDD_NULL;
 
   int s = 0; // index of a
   int t = 0; // index of b
   while(1) {
-    while(!(p == obdd_bot() || p == obdd_top())) {
+    while(!(p == OBDD_BOT || p == OBDD_TOP)) {
       b[t++]  = p;
-      a[s++]  = -(p->v);
-      p       = p->lo;
+      a[s++]  = -m->label[p];
+      p       = m->lo[p];
     }
-    if(p == obdd_top()) {
+    if(p == OBDD_TOP) {
         uintptr_t result = func(out, s, n, a);
         if(total < UINTPTR_MAX - result)
             total += result;
@@ -358,7 +513,7 @@ static uintptr_t obdd_decompose_main(FILE *out, int n, obdd_t* p, uintptr_t (*fu
     p = b[--t]; 
     while(a[--s] > 0) ;
     a[s] = abs(a[s]); s++;
-    p = p->hi;
+    p = m->hi[p];
   }
 
   free(b); free(a);
@@ -366,6 +521,325 @@ static uintptr_t obdd_decompose_main(FILE *out, int n, obdd_t* p, uintptr_t (*fu
 }
 
 
+// computed table of apply operations: the result r for node f in the state (k1, k2) of the operation.
+typedef struct {
+    obdd_t   f;
+    obdd_t   r;
+    uint64_t k1;
+    uint64_t k2;
+} obdd_centry;
+
+typedef struct {
+    obdd_centry* table;
+    size_t       cap;
+    size_t       used;
+} obdd_ctable;
+
+
+static void obdd_cinit(obdd_ctable* ct)
+{
+    ct->cap   = 1024;
+    ct->used  = 0;
+    ct->table = (obdd_centry*)calloc(ct->cap, sizeof(obdd_centry));
+    ENSURE_TRUE_MSG(ct->table != NULL, "memory allocation failed");
+}
+
+
+static inline size_t obdd_chash(obdd_t f, uint64_t k1, uint64_t k2)
+{
+    uint64_t h = (uint64_t)f;
+    h = (h * 0x9e3779b97f4a7c15ULL) ^ k1;
+    h = (h * 0x9e3779b97f4a7c15ULL) ^ k2;
+    h *= 0x9e3779b97f4a7c15ULL;
+    return (size_t)(h ^ (h >> 31));
+}
+
+
+// Return the entry of (f, k1, k2), which is empty (f field is OBDD_NULL) if not found.
+static obdd_centry* obdd_clookup(obdd_ctable* ct, obdd_t f, uint64_t k1, uint64_t k2)
+{
+    size_t h = obdd_chash(f, k1, k2) & (ct->cap-1);
+    obdd_centry* t = ct->table;
+    while (t[h].f != OBDD_NULL && (t[h].f != f || t[h].k1 != k1 || t[h].k2 != k2))
+        h = (h+1) & (ct->cap-1);
+    return &t[h];
+}
+
+
+static void obdd_cinsert(obdd_ctable* ct, obdd_t f, uint64_t k1, uint64_t k2, obdd_t r)
+{
+    if (2*(ct->used+1) > ct->cap) {
+        obdd_centry* old = ct->table;
+        size_t       cap = ct->cap;
+        ct->cap  *= 2;
+        ct->table = (obdd_centry*)calloc(ct->cap, sizeof(obdd_centry));
+        ENSURE_TRUE_MSG(ct->table != NULL, "memory allocation failed");
+        for (size_t i = 0; i < cap; i++)
+            if (old[i].f != OBDD_NULL)
+                *obdd_clookup(ct, old[i].f, old[i].k1, old[i].k2) = old[i];
+        free(old);
+    }
+    obdd_centry* e = obdd_clookup(ct, f, k1, k2);
+    e->f  = f;
+    e->r  = r;
+    e->k1 = k1;
+    e->k2 = k2;
+    ct->used++;
+}
+
+
+// Obtain the node with children lo and hi that replaces f, which has these children if they are not changed.
+static inline obdd_t obdd_apply_node(obdd_mgr* m, obdd_t f, int v, obdd_t lo, obdd_t hi)
+{
+    if (lo == OBDD_BOT && hi == OBDD_BOT)
+        return OBDD_BOT;
+    else if (lo == m->lo[f] && hi == m->hi[f])
+        return f;
+    else
+        return obdd_node(m, v, lo, hi);
+}
+
+
+typedef struct {
+    obdd_mgr*    m;
+    int          n;
+    int*         add_lo;  // the number of literals that become true on lo arc of nodes, indexed by labels.
+    int*         add_hi;  // the same for hi arc.
+    int*         rem;     // the most literals that can become true on and below nodes, indexed by labels.
+    int          atleast;
+    int          atmost;
+    obdd_ctable  ct;
+} obdd_card_st;
+
+
+static obdd_t obdd_and_card_rec(obdd_card_st* st, obdd_t f, int c)
+{
+    if (f == OBDD_BOT)
+        return OBDD_BOT;
+
+    obdd_mgr* m = st->m;
+    int       v = f == OBDD_TOP? st->n+1: m->label[f];
+    if (c + st->rem[v] < st->atleast)
+        return OBDD_BOT;
+    if (c >= st->atleast && c + st->rem[v] <= st->atmost)
+        return f; // satisfied whatever the remaining literals are
+
+    obdd_centry* e = obdd_clookup(&st->ct, f, (uint64_t)c, 0);
+    if (e->f != OBDD_NULL)
+        return e->r;
+
+    obdd_t lo  = m->lo[f];
+    obdd_t hi  = m->hi[f];
+    int    clo = c + st->add_lo[v];
+    int    chi = c + st->add_hi[v];
+    obdd_t rlo = clo > st->atmost? OBDD_BOT: obdd_and_card_rec(st, lo, clo);
+    obdd_t rhi = chi > st->atmost? OBDD_BOT: obdd_and_card_rec(st, hi, chi);
+    obdd_t r   = obdd_apply_node(m, f, v, rlo, rhi);
+
+    obdd_cinsert(&st->ct, f, (uint64_t)c, 0, r);
+    return r;
+}
+
+
+obdd_t obdd_and_card(obdd_mgr* m, int n, obdd_t p, const int* lits, int nlits, int atleast, int atmost)
+{
+    if (atmost < 0 || atleast > nlits)
+        return OBDD_BOT;
+
+    obdd_card_st st;
+    st.m       = m;
+    st.n       = n;
+    st.atleast = atleast;
+    st.atmost  = atmost;
+    st.add_lo  = (int*)calloc(3*(n+2), sizeof(int));
+    ENSURE_TRUE_MSG(st.add_lo != NULL, "memory allocation failed");
+    st.add_hi  = st.add_lo + (n+2);
+    st.rem     = st.add_hi + (n+2);
+    for (int i = 0; i < nlits; i++) {
+        int v = abs(lits[i]);
+        assert(v > 0 && v <= n);
+        if (lits[i] > 0)
+            st.add_hi[v]++;
+        else
+            st.add_lo[v]++;
+    }
+    for (int v = n; v > 0; v--)
+        st.rem[v] = st.rem[v+1] + (st.add_lo[v] > st.add_hi[v]? st.add_lo[v]: st.add_hi[v]);
+
+    obdd_cinit(&st.ct);
+    obdd_t r = obdd_and_card_rec(&st, p, 0);
+
+    free(st.ct.table);
+    free(st.add_lo);
+
+    return r;
+}
+
+
+// comparison of obdd_lexleq: the literal a is decided first, and b is decided at the same time or later.
+typedef struct {
+    int a;
+    int b;
+    int swap;  // if nonzero, a is the literal of y and b is that of x.
+} obdd_lexcmp;
+
+/* State of obdd_lexleq on a path: the comparisons in pend have their first literals decided, whose values are in vals.
+ * The first comparison found to differ is d (len if none), and the models are kept if ok is set.
+ * Comparisons after d are not needed any more, so they are not pending.
+ */
+typedef struct {
+    uint64_t pend;
+    uint64_t vals;
+    int      d;
+    int      ok;
+} obdd_lexstate;
+
+typedef struct {
+    obdd_mgr*    m;
+    int          n;
+    int          len;
+    obdd_lexcmp* cmp;
+    int*         first;   // the comparisons whose first literals have labels v are first[begin[v]], ..., first[begin[v+1]-1].
+    int*         second;  // the same for the second literals, by begin2.
+    int*         begin;
+    int*         begin2;
+    int*         maxb;    // the largest label of the second literals of the comparisons 0, ..., i-1 is maxb[i].
+    obdd_ctable  ct;
+} obdd_lex_st;
+
+
+static inline int obdd_litval(int lit, int b)
+{
+    return lit > 0? b: !b;
+}
+
+
+// Update s by the value b of the variable with label v, and return nonzero if the result is decided, i.e. the
+// comparisons before d are all decided too (every path visits all variables, so they are if their labels are at most v).
+static int obdd_lex_step(obdd_lex_st* st, obdd_lexstate* s, int v, int b)
+{
+    for (int k = st->begin[v]; k < st->begin[v+1]; k++) {
+        int i = st->first[k];
+        if (i >= s->d)
+            break;
+        s->pend |= (uint64_t)1 << i;
+        if (obdd_litval(st->cmp[i].a, b))
+            s->vals |= (uint64_t)1 << i;
+    }
+    for (int k = st->begin2[v]; k < st->begin2[v+1]; k++) {
+        int i = st->second[k];
+        if (i >= s->d)
+            break;
+        const obdd_lexcmp* c = &st->cmp[i];
+        int va = abs(c->a) == v? obdd_litval(c->a, b): (int)((s->vals >> i) & 1);
+        int vb = obdd_litval(c->b, b);
+        s->pend &= ~((uint64_t)1 << i);
+        s->vals &= ~((uint64_t)1 << i);
+        if (va != vb) {
+            int x = c->swap? vb: va;
+            s->d    = i;
+            s->ok   = x == 0;
+            s->pend &= ((uint64_t)1 << i) - 1;
+            s->vals &= ((uint64_t)1 << i) - 1;
+            break;
+        }
+    }
+    return s->d < st->len && st->maxb[s->d] <= v;
+}
+
+
+static obdd_t obdd_lexleq_rec(obdd_lex_st* st, obdd_t f, obdd_lexstate s)
+{
+    if (f == OBDD_BOT)
+        return OBDD_BOT;
+    if (f == OBDD_TOP) {
+        assert(s.pend == 0);
+        return s.d < st->len && !s.ok? OBDD_BOT: OBDD_TOP;
+    }
+
+    // d and ok are put in the bits of vals that are not used, because len < 48.
+    uint64_t k2 = s.vals | ((uint64_t)s.d << 48) | ((uint64_t)s.ok << 56);
+    obdd_centry* e = obdd_clookup(&st->ct, f, s.pend, k2);
+    if (e->f != OBDD_NULL)
+        return e->r;
+
+    obdd_mgr* m  = st->m;
+    int       v  = m->label[f];
+    obdd_t    lo = m->lo[f];
+    obdd_t    hi = m->hi[f];
+    obdd_t    r[2];
+    for (int b = 0; b < 2; b++) {
+        obdd_lexstate t     = s;
+        obdd_t        child = b? hi: lo;
+        if (obdd_lex_step(st, &t, v, b))
+            r[b] = t.ok? child: OBDD_BOT;
+        else
+            r[b] = obdd_lexleq_rec(st, child, t);
+    }
+    obdd_t res = obdd_apply_node(m, f, v, r[0], r[1]);
+
+    obdd_cinsert(&st->ct, f, s.pend, k2, res);
+    return res;
+}
+
+
+obdd_t obdd_lexleq(obdd_mgr* m, int n, obdd_t p, const int* x, const int* y, int len)
+{
+    if (len > 47)
+        len = 47;
+
+    obdd_lex_st st;
+    st.m   = m;
+    st.n   = n;
+    st.len = len;
+    st.cmp = (obdd_lexcmp*)malloc(sizeof(obdd_lexcmp)*(len > 0? len: 1));
+    int* buf = (int*)calloc(2*len + 2*(n+2) + len+1, sizeof(int));
+    ENSURE_TRUE_MSG(st.cmp != NULL && buf != NULL, "memory allocation failed");
+    st.first  = buf;
+    st.second = buf + len;
+    st.begin  = buf + 2*len;
+    st.begin2 = buf + 2*len + (n+2);
+    st.maxb   = buf + 2*len + 2*(n+2);
+
+    // bucket the comparisons by the labels of their literals, in increasing order of comparisons.
+    for (int i = 0; i < len; i++) {
+        assert(x[i] != y[i] && abs(x[i]) <= n && abs(y[i]) <= n);
+        int swap = abs(y[i]) < abs(x[i]);
+        st.cmp[i].a    = swap? y[i]: x[i];
+        st.cmp[i].b    = swap? x[i]: y[i];
+        st.cmp[i].swap = swap;
+        if (abs(st.cmp[i].a) != abs(st.cmp[i].b))
+            st.begin[abs(st.cmp[i].a)+1]++;
+        st.begin2[abs(st.cmp[i].b)+1]++;
+        st.maxb[i+1] = st.maxb[i] > abs(st.cmp[i].b)? st.maxb[i]: abs(st.cmp[i].b);
+    }
+    for (int v = 1; v <= n+1; v++) {
+        st.begin[v]  += st.begin[v-1];
+        st.begin2[v] += st.begin2[v-1];
+    }
+    int* pos  = (int*)malloc(sizeof(int)*2*(n+2));
+    ENSURE_TRUE_MSG(pos != NULL, "memory allocation failed");
+    memcpy(pos, st.begin, sizeof(int)*(n+2));
+    memcpy(pos + (n+2), st.begin2, sizeof(int)*(n+2));
+    for (int i = 0; i < len; i++) {
+        if (abs(st.cmp[i].a) != abs(st.cmp[i].b))
+            st.first[pos[abs(st.cmp[i].a)]++] = i;
+        st.second[pos[(n+2) + abs(st.cmp[i].b)]++] = i;
+    }
+    free(pos);
+
+    obdd_cinit(&st.ct);
+    obdd_lexstate s = { 0, 0, len, 1 };
+    obdd_t r = obdd_lexleq_rec(&st, p, s);
+
+    free(st.ct.table);
+    free(buf);
+    free(st.cmp);
+
+    return r;
+}
+
+
 /* \brief print a partial assignment that is stored in a.
  * \param   out     pointer to output file
  * \param   s       length of a in which valid values are contained, which may be less than the actual length of a.
@@ -387,7 +861,7 @@ static uintptr_t fprintf_partial(FILE *out, int s, int n, int *a)
 }
 
 
-uintptr_t obdd_decompose(FILE *out, int n, obdd_t* p)
+uintptr_t obdd_decompose(obdd_mgr* m, FILE *out, int n, obdd_t p)
 {
-    return obdd_decompose_main(out, n, p, fprintf_partial);
+    return obdd_decompose_main(m, out, n, p, fprintf_partial);
 }
@@ -4,6 +4,7 @@
  *  \note     For details of BDDs (Binary Decision Diagrams), see
  *  - Bryant, R.E.: Graph-Based algorithm for Boolean function manipulation, IEEE Trans. Comput., Vol.35, pp.677-691 (1986)
  *  - Knuth, D.E.: The Art of Computer Programming Volume 4a, Addison-Wesley Professional, New Jersey, USA (2011) .
+ *  \note     Nodes are 32-bit indices into arrays of their manager, so that a node takes 16 bytes.
  */
 #ifndef OBDD_H
 #define OBDD_H
@@ -13,6 +14,8 @@
 #include <limits.h>
 #include <stdint.h>
 
+#include "vec.h"
+
 #ifdef GMP
 #include <gmp.h>
 #endif
@@ -21,48 +24,88 @@
 /* Type declarations                                                         */
 /*---------------------------------------------------------------------------*/
 
-typedef struct obdd_st obdd_t;
-
-/** \brief  binary decidion diagram node*/
-struct obdd_st {
-  int              v;      //!< assigned label
-  intptr_t       aux;      //!< an auxiliary field (of pointer size), which is introduced in order to facilitate implementation.
-  struct obdd_st  *lo;      //!< low arc
-  struct obdd_st  *hi;      //!< hi arc
-  struct obdd_st  *nx;      //!< 
-};
+/** \brief  binary decidion diagram node, which is an index into the arrays of its manager.*/
+typedef uint32_t obdd_t;
 
+#define OBDD_NULL   ((obdd_t)0) //!< no node, e.g. a child that is not constructed yet
+#define OBDD_BOT    ((obdd_t)1) //!< bottom terminal node
+#define OBDD_TOP    ((obdd_t)2) //!< top terminal node
+#define OBDD_FIRST  ((obdd_t)3) //!< the first index of nonterminal nodes
 
-extern obdd_t *top_node; //!< top terminal node
-extern obdd_t *bot_node; //!< bottom terminal node
+/** \brief  node storage: all nodes of an obdd belong to the same manager, which must not be shared between threads.
+ *  \note
+ *  - Fields of nodes are stored in separate arrays, which are indexed by nodes. Free nodes have label 0.
+ *  - A manager holds at most one obdd at a time: all nonterminal nodes in use are assumed to be nodes of that obdd.
+ */
+typedef struct obdd_mgr_st {
+  int*            label;      //!< assigned labels
+  obdd_t*         lo;         //!< low arcs
+  obdd_t*         hi;         //!< hi arcs
+  obdd_t*         aux;        //!< an auxiliary field, which is introduced in order to facilitate implementation.
+  obdd_t          pos;        //!< index of the next new node
+  obdd_t          cap;        //!< the number of nodes allocated for the arrays
+  obdd_t          hwm;        //!< the most nodes in use since the last trim
+  int             nreleases;  //!< releases since the last trim
+  obdd_t          freelist;   //!< nodes freed by obdd_share, linked by aux field
+  uintmax_t       nnodes;     //!< the number of nonterminal nodes in use
+  obdd_t*         utable;     //!< unique table used by obdd_share
+  size_t          ucap;       //!< the number of slots allocated for utable
+} obdd_mgr;
+
+/** \brief  unsigned 128-bit number hi*2^64 + lo, used for exact solution counts.*/
+typedef struct obdd_count_st {
+  uint64_t        hi;
+  uint64_t        lo;
+} obdd_count_t;
 
 /*---------------------------------------------------------------------------*/
 /* Function prototypes                                                       */
 /*---------------------------------------------------------------------------*/
 
+/* \brief   Setup an empty node manager.
+ */
+extern void obdd_initialize(obdd_mgr* m);
+
+
+/* \brief   Release all nodes of m.
+ * \param   final   if nonzero, m is not used any more; otherwise, it can be used again.
+ * \note    Unless final is set, the arrays are kept for reuse. They are shrunk to the most nodes used during the last few releases.
+ */
+extern void obdd_release(obdd_mgr* m, int final);
+
 
 /* \brief   Obtain obdd node with specified field.
+ * \param   m   node manager, from which the node is taken
  * \param   v   variable index, which must be a non-zero positive interger.
  * \param   lo  lo child
  * \param   hi  hi child
- * \return  pointer to an obtained node
+ * \return  an obtained node
+ * \note    The arrays of m may be reallocated: do not keep pointers into them across this call.
  */
-extern obdd_t* obdd_node(int v, obdd_t* lo, obdd_t* hi);
+extern obdd_t obdd_node(obdd_mgr* m, int v, obdd_t lo, obdd_t hi);
 
 
-/* \brief For all nodes in p, if their lo or hi field is NULL, set bottom terminal.
+/* \brief For all nodes in p, if their lo or hi field is OBDD_NULL, set bottom terminal.
  * \return the number of nonterminal nodes
+ * \note   Since obdd constructed by sat solver may be imcomplete, call this function before applying other functions.
+ */
+extern uintmax_t obdd_complete(obdd_mgr* m, obdd_t p);
+
+
+/* \brief Merge equivalent nodes in p, i.e. nodes with the same label and children, so that they are shared.
+ * \param n     the number of variables
+ * \param p     root of obdd, which must be completed by obdd_complete.
+ * \return the number of nonterminal nodes after merging
  * \note
- * - Since obdd constructed by sat solver may be imcomplete, call this function before applying other functions.
- * - That is, after this function finishes, all nodes below p are linked from p by nx field, which are assumed in executing other obdd function for the sake of efficiency.
- * - If it is called for different obdds, all nodes in the last obdd are linked, while those in other obdds may not! If necessary, call this function again.
+ * - Nodes are looked up bottom-up in a unique table (open addressing on label, lo and hi), and duplicates are freed.
+ * - Nodes with the same children are not removed, so that every path still visits all variables and the number of paths is unchanged.
  */
-extern uintmax_t obdd_complete(obdd_t* p);
+extern uintmax_t obdd_share(obdd_mgr* m, int n, obdd_t p);
 
 
 /* \brief Count the number of all nodes in p except for terminal nodes.
  */
-extern uintmax_t obdd_size(obdd_t* p);
+extern uintmax_t obdd_size(obdd_mgr* m, obdd_t p);
 
 /* \brief Make a file in dot format that represents the graph structure of p.
  * \param n     the number of variables
@@ -71,15 +114,24 @@ extern uintmax_t obdd_size(obdd_t* p);
  * \return ST_SUCCESS if successful; ST_FAILURE, otherwise.
  * \note    See www.graphviz.org/ .
  */
-extern int obdd_to_dot(int n, obdd_t* p, FILE *out);
+extern int obdd_to_dot(obdd_mgr* m, int n, obdd_t p, FILE *out);
 
 
 /* \brief Count the number of paths from the root to the top terminal in p, which corresponds to the number of total satisfying assignments, i.e. solutions.
  * \param n     the number of variables
  * \param p     root of obdd
  * \return the computed number
+ * \note  Children that are not constructed yet are regarded as bottom terminal, so that this can be called during construction.
+ */
+extern intptr_t obdd_nsols(obdd_mgr* m, int n, obdd_t p);
+
+
+/* \brief 128-bit version of obdd_nsols, which visits only the nodes reachable from p.
+ * \param n     the number of variables
+ * \param p     root of obdd, which may also be a result of obdd_and_card or obdd_lexleq
+ * \return the computed number, which is saturated only at 2^128-1.
  */
-extern intptr_t obdd_nsols(int n, obdd_t* p);
+extern obdd_count_t obdd_nsols_wide(obdd_mgr* m, int n, obdd_t p);
 
 
 #ifdef GMP
@@ -89,7 +141,7 @@ extern intptr_t obdd_nsols(int n, obdd_t* p);
  * \param p     root of obdd
  * \note see The GNU MP Bignum Library: https://gmplib.org/ .
  */
-extern void obdd_nsols_gmp(mpz_t result, int n, obdd_t* p);
+extern void obdd_nsols_gmp(obdd_mgr* m, mpz_t result, int n, obdd_t p);
 #endif
 
 
@@ -102,60 +154,111 @@ extern void obdd_nsols_gmp(mpz_t result, int n, obdd_t* p);
  * - when this function is called several times, results are appended to output file.
  * - Please take care that a huge number of assignments may be generated.
  */
-extern uintptr_t obdd_decompose(FILE *out, int n, obdd_t* p);
+extern uintptr_t obdd_decompose(obdd_mgr* m, FILE *out, int n, obdd_t p);
 
 
-/* \brief   Return the total number of obdd nodes that have been created so far.
+/* \brief   Return the number of nonterminal obdd nodes in use.
  */
-extern uintmax_t obdd_nnodes(void); 
+extern uintmax_t obdd_nnodes(obdd_mgr* m); 
 
 
 /* \brief Delete p and all non-terminal nodes below p. 
  */
-extern void obdd_delete_all(obdd_t* p);
+extern void obdd_delete_all(obdd_mgr* m, obdd_t p);
+
+
+/* \brief   Mark the nodes in use, so that the nodes obtained after this call can be deleted at once by obdd_rewind.
+ * \return  the mark to be passed to obdd_rewind
+ * \note    Nodes freed before this call are not reused until m is released.
+ */
+extern obdd_t obdd_mark(obdd_mgr* m);
+
+
+/* \brief   Delete all nodes obtained after mark was returned by obdd_mark.
+ */
+extern void obdd_rewind(obdd_mgr* m, obdd_t mark);
 
 
-// v field must be accessed by this function, because it may have negative value during traversal of obdd.
-static inline int obdd_label(obdd_t* p)
+/* \brief Conjoin p with a cardinality constraint on literals, i.e. atleast <= (the number of true literals) <= atmost.
+ * \param n       the number of variables
+ * \param p       root of obdd, which must be completed by obdd_complete.
+ * \param lits    literals, where i and -i mean that the variable with label i is true and false, respectively.
+ * \param nlits   the number of literals
+ * \return root of the resulted obdd
+ * \note
+ * - Unit clauses, clauses and at-most-one constraints are special cases: (atleast, atmost) = (nlits, nlits), (1, nlits) and (0, 1).
+ * - p is not changed, and its nodes below the last literal are shared by the result. Nodes whose paths all reach bottom terminal are replaced by it.
+ * - Call obdd_mark before this function, because the nodes of the result are not seen by obdd_complete and other functions that traverse all nodes of m.
+ */
+extern obdd_t obdd_and_card(obdd_mgr* m, int n, obdd_t p, const int* lits, int nlits, int atleast, int atmost);
+
+
+/* \brief Keep the models of p in which the sequence of the values of x is lexicographically smaller than or equal to that of y.
+ * \param n     the number of variables
+ * \param p     root of obdd, which must be completed by obdd_complete.
+ * \param x     literals, where i and -i mean that the variable with label i is true and false, respectively.
+ * \param y     literals compared with x, where x[i] and y[i] must differ.
+ * \param len   the number of the compared positions, of which at most the first 47 are compared.
+ * \return root of the resulted obdd
+ * \note  The models are removed if the first position that differs has true in x. See also the note of obdd_and_card.
+ */
+extern obdd_t obdd_lexleq(obdd_mgr* m, int n, obdd_t p, const int* x, const int* y, int len);
+
+
+static inline int obdd_label(obdd_mgr* m, obdd_t p)
+{
+  return m->label[p];
+}
+
+
+static inline obdd_t obdd_lo(obdd_mgr* m, obdd_t p)
+{
+  return m->lo[p];
+}
+
+
+static inline obdd_t obdd_hi(obdd_mgr* m, obdd_t p)
 {
-  return abs(p->v);
+  return m->hi[p];
 }
 
 
-// v field must be accessed by this function, because it may have negative value during traversal of obdd.
-static inline void obdd_setlabel(int v, obdd_t* p)
+static inline void obdd_setlo(obdd_mgr* m, obdd_t p, obdd_t q)
 {
-  p->v = abs(v);
+  m->lo[p] = q;
+}
+
+
+static inline void obdd_sethi(obdd_mgr* m, obdd_t p, obdd_t q)
+{
+  m->hi[p] = q;
 }
 
 
 /* \brief   Obtain the top terminal node.
  */
-static inline obdd_t* obdd_top()
+static inline obdd_t obdd_top(obdd_mgr* m)
 {
-    if(top_node == NULL)
-        top_node = obdd_node(INT_MAX, NULL, NULL);
-
-    return top_node;
+    (void)m;
+    return OBDD_TOP;
 }
 
 
 /* \brief   Obtain the bottom terminal node.
  */
-static inline obdd_t* obdd_bot()
+static inline obdd_t obdd_bot(obdd_mgr* m)
 {
-    if(bot_node == NULL)
-        bot_node = obdd_node(INT_MAX, NULL, NULL);
-
-    return bot_node;
+    (void)m;
+    return OBDD_BOT;
 }
 
 
 /* \brief Decide if p is a terminal node.
  * \return true if p is a terminal node; false, otherwise.
  */
-static inline int obdd_const(obdd_t* p)
+static inline int obdd_const(obdd_mgr* m, obdd_t p)
 {
-    return p == obdd_bot() || p == obdd_top();
+    (void)m;
+    return p == OBDD_BOT || p == OBDD_TOP;
 }
 #endif /*OBDD_H*/
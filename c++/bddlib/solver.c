@@ -23,6 +23,7 @@ OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWA
 #include <stdio.h>
 #include <assert.h>
 #include <math.h>
+#include <string.h>
 
 #include "solver.h"
 #include "obdd.h"
@@ -253,9 +254,10 @@ static void perform_resolution(solver *s, veci *cl1, veci *cl2, veci *cl3)
 
 void totalup_stats(solver *s)
 {
-    intptr_t sols = s->root->aux;
-
-    uint64 size = (uint64)obdd_complete(s->root);
+    uint64 size = (uint64)obdd_complete(&s->ctx->obdd, s->root);
+#ifdef UNIQUETABLE
+    size = (uint64)obdd_share(&s->ctx->obdd, s->size, s->root);
+#endif
 
     // total up obdd size
     s->stats.obddsize += size;
@@ -265,13 +267,14 @@ void totalup_stats(solver *s)
     mpz_t result;
     mpz_init(result);
     mpz_set_ui(result,0);
-    obdd_nsols_gmp(result, s->size, s->root);
+    obdd_nsols_gmp(&s->ctx->obdd, result, s->size, s->root);
     mpz_add(s->stats.tot_solutions_gmp, s->stats.tot_solutions_gmp, result); 
     mpz_clear(result);
 
 #else
+    intptr_t sols = obdd_nsols(&s->ctx->obdd, s->size, s->root);
     if(s->stats.tot_solutions <= ULONG_MAX - sols)
-        s->stats.tot_solutions += sols; // Note: s->root->aux can not count more than INTPTR_MAX!
+        s->stats.tot_solutions += sols; // Note: obdd_nsols can not count more than INTPTR_MAX!
     else
         s->stats.tot_solutions = ULONG_MAX;
 #endif
@@ -288,8 +291,9 @@ static inline void solver_printstatus(solver *s)
     printf("\t%ju", s->stats.propagations);
 
     if (s->stats.refreshes == 0) {
-        printf("\t%jd", s->root->aux);
-        if (s->root->aux >= INTPTR_MAX)
+        intptr_t sols = obdd_nsols(&s->ctx->obdd, s->size, s->root);
+        printf("\t%jd", sols);
+        if (sols >= INTPTR_MAX)
             printf("+");
     } else {
         printf("\t-");
@@ -297,7 +301,7 @@ static inline void solver_printstatus(solver *s)
         
     printf("\t\t%d", vecp_size(&s->clauses));
     printf("\t\t%d", vecp_size(&s->learnts));
-    printf("\t\t%ju", obdd_nnodes());
+    printf("\t\t%ju", obdd_nnodes(&s->ctx->obdd));
     printf("\n");
 }
 
@@ -448,10 +452,79 @@ static inline void act_clause_bump(solver* s, clause *c) {
 static inline void act_clause_decay(solver* s) { s->cla_inc *= s->cla_decay; }
 
 
+//=================================================================================================
+// Clause arena:
+
+static const int arena_blocksize = 1 << 16;
+
+static void arena_init(solver* s)
+{
+    vecp_new(&s->blocks);
+    vecp_new(&s->large);
+    s->block         = 0;
+    s->blockpos      = 0;
+    s->mark_block    = 0;
+    s->mark_blockpos = 0;
+    s->mark_large    = 0;
+}
+
+static void* arena_alloc(solver* s, int bytes)
+{
+    bytes = (bytes + 7) & ~7;
+    if (bytes > arena_blocksize) {
+        void* p = malloc(bytes);
+        assert(p != NULL);
+        vecp_push(&s->large, p);
+        return p;
+    }
+
+    if (vecp_size(&s->blocks) == 0 || s->blockpos + bytes > arena_blocksize) {
+        if (vecp_size(&s->blocks) > 0)
+            s->block++;
+        if (s->block == vecp_size(&s->blocks))
+            vecp_push(&s->blocks, malloc(arena_blocksize));
+        assert(vecp_begin(&s->blocks)[s->block] != NULL);
+        s->blockpos = 0;
+    }
+
+    void* p = (char*)vecp_begin(&s->blocks)[s->block] + s->blockpos;
+    s->blockpos += bytes;
+    return p;
+}
+
+// Everything allocated from now on is released by arena_rewind().
+static void arena_setmark(solver* s)
+{
+    s->mark_block    = s->block;
+    s->mark_blockpos = s->blockpos;
+    s->mark_large    = vecp_size(&s->large);
+}
+
+// Release all clauses allocated after the mark, keeping the blocks for reuse.
+static void arena_rewind(solver* s)
+{
+    for (int i = s->mark_large; i < vecp_size(&s->large); i++)
+        free(vecp_begin(&s->large)[i]);
+    vecp_resize(&s->large, s->mark_large);
+    s->block    = s->mark_block;
+    s->blockpos = s->mark_blockpos;
+}
+
+static void arena_delete(solver* s)
+{
+    for (int i = 0; i < vecp_size(&s->blocks); i++)
+        free(vecp_begin(&s->blocks)[i]);
+    for (int i = 0; i < vecp_size(&s->large); i++)
+        free(vecp_begin(&s->large)[i]);
+    vecp_delete(&s->blocks);
+    vecp_delete(&s->large);
+}
+
 //=================================================================================================
 // Clause functions:
 
 /* pre: size > 1 && no variable occurs twice
+ * note: clauses live in the arena: removed clauses are released by solver_reset() or solver_delete().
  */
 static clause* clause_new(solver* s, lit* begin, lit* end, int learnt)
 {
@@ -462,7 +535,7 @@ static clause* clause_new(solver* s, lit* begin, lit* end, int learnt)
     assert(end - begin > 1);
     assert(learnt >= 0 && learnt < 2);
     size           = end - begin;
-    c              = (clause*)malloc(sizeof(clause) + sizeof(lit) * size + learnt * sizeof(float));
+    c              = (clause*)arena_alloc(s, sizeof(clause) + sizeof(lit) * size + learnt * sizeof(float));
     c->size_learnt = (size << 1) | learnt;
     assert(((unsigned long)c & 1) == 0);
 
@@ -490,19 +563,9 @@ static clause* clause_new(solver* s, lit* begin, lit* end, int learnt)
 }
 
 
-static void clause_remove(solver* s, clause* c)
+// Bookkeeping for a clause that is no longer watched.
+static void clause_forget(solver* s, clause* c)
 {
-    lit* lits = clause_begin(c);
-    assert(lit_neg(lits[0]) < s->size*2);
-    assert(lit_neg(lits[1]) < s->size*2);
-
-    //vecp_remove(solver_read_wlist(s,lit_neg(lits[0])),(void*)c);
-    //vecp_remove(solver_read_wlist(s,lit_neg(lits[1])),(void*)c);
-
-    assert(lits[0] < s->size*2);
-    vecp_remove(solver_read_wlist(s,lit_neg(lits[0])),(void*)(clause_size(c) > 2 ? c : clause_from_lit(lits[1])));
-    vecp_remove(solver_read_wlist(s,lit_neg(lits[1])),(void*)(clause_size(c) > 2 ? c : clause_from_lit(lits[0])));
-
     if (clause_learnt(c)){
         s->stats.learnts--;
         s->stats.learnts_literals -= clause_size(c);
@@ -510,13 +573,10 @@ static void clause_remove(solver* s, clause* c)
         s->stats.clauses--;
         s->stats.clauses_literals -= clause_size(c);
     }
-
-    free(c);
 }
 
 
-#ifdef CUTSETCACHE
-static void clause_remove_nofree(solver* s, clause* c)
+static void clause_remove(solver* s, clause* c)
 {
     lit* lits = clause_begin(c);
     assert(lit_neg(lits[0]) < s->size*2);
@@ -529,17 +589,8 @@ static void clause_remove_nofree(solver* s, clause* c)
     vecp_remove(solver_read_wlist(s,lit_neg(lits[0])),(void*)(clause_size(c) > 2 ? c : clause_from_lit(lits[1])));
     vecp_remove(solver_read_wlist(s,lit_neg(lits[1])),(void*)(clause_size(c) > 2 ? c : clause_from_lit(lits[0])));
 
-    if (clause_learnt(c)){
-        s->stats.learnts--;
-        s->stats.learnts_literals -= clause_size(c);
-    }else{
-        s->stats.clauses--;
-        s->stats.clauses_literals -= clause_size(c);
-    }
-    vecp_push(&s->toremove, c);
-    //free(c);
+    clause_forget(s,c);
 }
-#endif
 
 static lbool clause_simplify(solver* s, clause* c)
 {
@@ -558,6 +609,36 @@ static lbool clause_simplify(solver* s, clause* c)
 }
 
 
+// Detach all the clauses removed by solver_simplify() (satisfied and
+// not a reason) in one pass over the watch lists.
+static void solver_detachsatisfied(solver* s)
+{
+    lbool*   values  = s->assigns;
+    clause** reasons = s->reasons;
+    int l, i, j;
+
+    for (l = 0; l < s->size*2; l++){
+        vecp*  ws = solver_read_wlist(s,l);
+        void** w  = vecp_begin(ws);
+        for (i = j = 0; i < vecp_size(ws); i++){
+            clause* c = (clause*)w[i];
+            bool    sat;
+            if (clause_is_lit(c)){ // binary clause of lit_neg(l) and the encoded literal
+                lit   a    = lit_neg(l);
+                lit   b    = clause_read_lit(c);
+                lbool siga = !lit_sign(a); siga += siga - 1;
+                lbool sigb = !lit_sign(b); sigb += sigb - 1;
+                sat = values[lit_var(a)] == siga || values[lit_var(b)] == sigb;
+            }else
+                sat = reasons[lit_var(*clause_begin(c))] != c && clause_simplify(s,c) == l_True;
+            if (!sat)
+                w[j++] = c;
+        }
+        vecp_resize(ws,j);
+    }
+}
+
+
 
 static lbool clause_simplify_noprop_until(solver* s, clause* c, int var) // evaluate clause without information of unit propagation
 {
@@ -637,6 +718,12 @@ static void solver_setcutsets(solver* s)
             free(s->cutsets[i]);
         s->cutsets[i] = (clause**)malloc(sizeof(clause*)*s->cutwidth[i]);
         assert(s->cutsets[i] != NULL);
+        free(s->cutprev[i]);
+        s->cutprev[i] = (int*)malloc(sizeof(int)*s->cutwidth[i]);
+        assert(s->cutprev[i] != NULL);
+        free(s->cutlits[i]);
+        s->cutlits[i] = (lit*)malloc(sizeof(lit)*s->cutwidth[i]);
+        assert(s->cutlits[i] != NULL);
     }
 
     int* w = (int*)malloc(sizeof(int)*nvars);  // working space
@@ -644,10 +731,19 @@ static void solver_setcutsets(solver* s)
     for (int i = 0; i < nvars; i++)
         w[i] = 0;
     for (int i = 0; i < m; i++) {
-        for (int j = lit_var(clause_minlit(cls[i])); j < lit_var(clause_maxlit(cls[i])); j++) {
+        const int maxvar = lit_var(clause_maxlit(cls[i]));
+        int prev = -1;
+        for (int j = lit_var(clause_minlit(cls[i])); j < maxvar; j++) {
             assert(w[j] < s->cutwidth[j]);
+            s->cutprev[j][w[j]] = prev;
+            s->cutlits[j][w[j]] = lit_Undef;
+            prev = w[j];
             s->cutsets[j][w[j]++] = cls[i];
         }
+        for (lit* l = clause_begin(cls[i]); l < clause_end(cls[i]); l++) {
+            if (lit_var(*l) < maxvar)
+                s->cutlits[lit_var(*l)][w[lit_var(*l)]-1] = *l;
+        }
     }
 
     free(w);
@@ -715,16 +811,70 @@ static void solver_setseparators(solver* s)
 }
 #endif
 
+#ifdef CUTSETCACHE
+// Sets the cache key of variable i from the one of variable i-1: a cutset
+// clause is satisfied by the variables up to i if it is satisfied by the
+// ones up to i-1, or if its literal of i is true.
+static inline void solver_extendkey(solver* s, int i)
+{
+    const int     cutwidth = s->cutwidth[i];
+    unsigned int* vec  = vecp_begin(&s->bitvecs)[i];
+    unsigned int* prev = vecp_begin(&s->bitvecs)[i-1];
+    const int*    pos  = s->cutprev[i];
+    const lit*    lits = s->cutlits[i];
+    const lit     t    = s->assigns[i] == l_True? toLit(i): lit_neg(toLit(i));
+
+    assert(i > 0 && s->assigns[i] != l_Undef);
+    // assembled a word at a time without branches
+    for (int j = 0; j < cutwidth; j += WORDSIZE) {
+        const int    n = cutwidth-j < WORDSIZE? cutwidth-j: WORDSIZE;
+        unsigned int w = 0;
+        for (int b = 0; b < n; b++) {
+            const int p = pos[j+b];
+            w |= (unsigned int)((lits[j+b] == t) | ((p >= 0) & DIGIT(prev, p >= 0? p: 0))) << b;
+        }
+        vec[j/WORDSIZE] = w;
+    }
+}
+#endif
+
+#ifndef MAXKEYGAP
+#define MAXKEYGAP 5 // extending a key over a level costs about a fifth of building it from the clauses
+#endif
+
 static void solver_makecache(solver* s, unsigned int* vec, int i)
 {
 #ifdef CUTSETCACHE
-    const int cutwidth  = s->cutwidth[i];
-
-    UNSET_ALL_DIGIT(vec, cutwidth);
-    for (int j = 0; j < cutwidth; j++) {
-        if (clause_simplify_noprop_until(s, s->cutsets[i][j], i) == l_True)    
-            SET_DIGIT(vec, j);
+    // a key stays valid until a variable at or below it is unassigned; the key
+    // of i is extended level by level from the nearest valid key below it if
+    // that is at most MAXKEYGAP levels away, and built from the clauses otherwise
+    assert(vec == vecp_begin(&s->bitvecs)[i]);
+    if (i >= s->nkeys && i != s->lastkey) {
+        const int k = s->lastkey < i && s->lastkey >= s->nkeys? s->lastkey: s->nkeys-1;
+        if (k >= 0 && i-k <= MAXKEYGAP) {
+            for (int v = k+1; v <= i; v++)
+                solver_extendkey(s, v);
+            if (k == s->nkeys-1)
+                s->nkeys = i+1;
+            else
+                s->lastkey = i;
+        } else {
+            const int cutwidth = s->cutwidth[i];
+            UNSET_ALL_DIGIT(vec, cutwidth);
+            for (int j = 0; j < cutwidth; j++) {
+                if (clause_simplify_noprop_until(s, s->cutsets[i][j], i) == l_True)
+                    SET_DIGIT(vec, j);
+            }
+            if (i == s->nkeys)
+                s->nkeys++;
+            else
+                s->lastkey = i;
+        }
     }
+#ifndef NDEBUG
+    for (int j = 0; j < s->cutwidth[i]; j++)
+        assert(DIGIT(vec, j) == (clause_simplify_noprop_until(s, s->cutsets[i][j], i) == l_True));
+#endif
 
 #else /*SEPARATORCACHE*/
     const int pathwidth  = s->pathwidth[i];
@@ -748,15 +898,17 @@ static void solver_initcache(solver *s)
     }
     vecp_resize(&s->bitvecs, 0);
 
-    trie_initialize();
+    trie_initialize(&s->ctx->trie);
 
 #ifdef CUTSETCACHE
     solver_setminmaxlit(s);
     solver_setcutsets(s);
+    s->nkeys = 0;
+    s->lastkey = -1;
 
     for (int i = 0; i < s->size; i++) {
-        s->cache[i]  = trie_create(s->cutwidth[i]);
-        const int nwords = GET_NWORDS(s->cutwidth[i]);
+        s->cache[i]  = trie_create(&s->ctx->trie, s->cutwidth[i]);
+        const int nwords = GET_NWORDS(s->cutwidth[i]) + (s->cutwidth[i] == 0); // solver_extendkey() reads a word of an empty key
         unsigned int *vec = (unsigned int*)malloc(sizeof(unsigned int) * nwords);
         assert(vec != NULL);
         for (int j = 0; j < nwords; j++)
@@ -768,7 +920,7 @@ static void solver_initcache(solver *s)
     solver_setseparators(s);
 
     for (int i = 0; i < s->size; i++) {
-        s->cache[i]  = trie_create(s->pathwidth[i]);
+        s->cache[i]  = trie_create(&s->ctx->trie, s->pathwidth[i]);
         const int nwords = GET_NWORDS(s->pathwidth[i]);
         unsigned int *vec = (unsigned int*)malloc(sizeof(unsigned int) * nwords);
         assert(vec != NULL);
@@ -780,24 +932,58 @@ static void solver_initcache(solver *s)
 }
 
 
+// Evicts the caches of levels until they fit in the budget, in the
+// order of a clock over the levels that spares the caches hit since
+// it passed them last (and clears their reference).
+static void solver_evictcache(solver* s)
+{
+    trie_mgr* m = &s->ctx->trie;
+    for (int n = 0; n < 2*s->size && m->inuse > s->cachebudget; n++) {
+        trie_t* t = s->cache[s->cachehand];
+        s->cachehand = (s->cachehand + 1) % s->size;
+        if (t == NULL || t->chunks == NULL)
+            continue;
+        if (t->ref) {
+            t->ref = 0;
+            continue;
+        }
+        trie_clear(t);
+        s->stats.ncacheevictions++;
+    }
+    trie_trim(m, s->cachebudget);
+}
+
+
+static inline void solver_checkcache(solver* s)
+{
+    const size_t inuse = s->ctx->trie.inuse;
+    if (s->cachebudget > 0 && inuse > s->cachebudget)
+        solver_evictcache(s);
+    if (inuse > s->stats.maxcachebytes)
+        s->stats.maxcachebytes = inuse;
+}
+
+
 static void solver_insertcacheuntil(solver* s, int level)
 {
     // s->obddpath holds the latest path added to OBDD.  
-    if (!(vecp_size(&s->obddpath) > 0)) 
+    if (!(veci_size(&s->obddpath) > 0)) 
         return;
 
     const int k = (level >= s->root_level)? lit_var(solver_assumedlit(s,level+1)): 0;
     int j = 0;
 
-    for (int i = 0; i < vecp_size(&s->obddpath)-1; i++) { 
-        obdd_t* p = vecp_begin(&s->obddpath)[i];
-        assert(obdd_label(p) == i+1);
+    obdd_mgr* m = &s->ctx->obdd;
+    obdd_t*   path = (obdd_t*)veci_begin(&s->obddpath);
+    for (int i = 0; i < veci_size(&s->obddpath)-1; i++) { 
+        obdd_t p = path[i];
+        assert(obdd_label(m, p) == i+1);
         assert(s->assigns[i] != l_Undef);
-        obdd_t* q = s->assigns[i] == l_True? p->hi: p->lo;
+        obdd_t q = s->assigns[i] == l_True? obdd_hi(m, p): obdd_lo(m, p);
 
-        if (q != vecp_begin(&s->obddpath)[i+1]) {
+        if (q != path[i+1]) {
             if (k <= i) 
-                vecp_resize(&s->obddpath, k+1);
+                veci_resize(&s->obddpath, k+1);
             return;
         }
         if (i < k)  
@@ -806,12 +992,14 @@ static void solver_insertcacheuntil(solver* s, int level)
         int* vars = veci_begin(&s->cachedvars);
         int  len  = veci_size(&s->cachedvars);
         for (; j < len && vars[j] < i; j++) ;
-        if (j < len && vars[j] == i) // insert only when cache is created.
-            trie_insert((unsigned int*)vecp_begin(&s->bitvecs)[i], (intptr_t)vecp_begin(&s->obddpath)[i+1], s->cache[i]);
+        if (j < len && vars[j] == i) { // insert only when cache is created.
+            trie_insert((unsigned int*)vecp_begin(&s->bitvecs)[i], (uintptr_t)path[i+1], s->cache[i]);
+            solver_checkcache(s);
+        }
     }
 
-    if (k+1 < vecp_size(&s->obddpath)) 
-        vecp_resize(&s->obddpath, k+1);
+    if (k+1 < veci_size(&s->obddpath)) 
+        veci_resize(&s->obddpath, k+1);
 }
 
 
@@ -825,14 +1013,14 @@ static void solver_refreshobdd(solver *s)
 
     if (s->out != NULL) {
         //printf("\tdecomposing bdd...");fflush(stdout);
-        obdd_decompose(s->out, s->size, s->root);
+        obdd_decompose(&s->ctx->obdd, s->out, s->size, s->root);
     }
 
-    obdd_delete_all(s->root);
-    s->root = obdd_node(1, NULL, NULL);
+    obdd_delete_all(&s->ctx->obdd, s->root);
+    s->root = obdd_node(&s->ctx->obdd, 1, OBDD_NULL, OBDD_NULL);
 
-    trie_initialize();
-    vecp_resize(&s->obddpath, 0);
+    trie_initialize(&s->ctx->trie);
+    veci_resize(&s->obddpath, 0);
     veci_resize(&s->cachedvars, 0);
     //printf("\tfin\n");fflush(stdout);
 }
@@ -841,6 +1029,12 @@ static void solver_refreshobdd(solver *s)
 //=================================================================================================
 // Minor (solver) functions:
 
+void solver_setcachebudget(solver* s, size_t bytes)
+{
+    s->cachebudget = bytes;
+}
+
+
 void solver_setnvars(solver* s,int n)
 {
     int var;
@@ -865,15 +1059,29 @@ void solver_setnvars(solver* s,int n)
 #ifdef CUTSETCACHE
         s->cutwidth  = (int*)    realloc(s->cutwidth, sizeof(int)*s->cap);
         s->cutsets   = (clause***)  realloc(s->cutsets,  sizeof(clause**)*s->cap);
+        s->cutprev   = (int**)   realloc(s->cutprev,  sizeof(int*)*s->cap);
+        s->cutlits   = (lit**)   realloc(s->cutlits,  sizeof(lit*)*s->cap);
 #else /*SEPARATORCACHE*/
         s->pathwidth = (int*)    realloc(s->pathwidth,     sizeof(int)*s->cap);
         s->separators = (int**)  realloc(s->separators,  sizeof(int*)*s->cap);
 #endif
 
+	// the caches and cutsets are made by solver_solve, so they are
+	// empty until then (as after solver_reset), and can be deleted
 	for(var = oldcap; var < s->cap; var++)
 	  {
 	    vecp_new(&s->wlists[2*var]);
 	    vecp_new(&s->wlists[2*var+1]);
+	    s->cache[var] = NULL;
+#ifdef CUTSETCACHE
+	    s->cutwidth[var] = 0;
+	    s->cutsets[var]  = NULL;
+	    s->cutprev[var]  = NULL;
+	    s->cutlits[var]  = NULL;
+#else /*SEPARATORCACHE*/
+	    s->pathwidth[var]  = 0;
+	    s->separators[var] = NULL;
+#endif
 	  }
     }
 
@@ -890,6 +1098,8 @@ void solver_setnvars(solver* s,int n)
 #ifdef CUTSETCACHE
         s->cutwidth [var] = 0;
         s->cutsets  [var] = NULL;
+        s->cutprev  [var] = NULL;
+        s->cutlits  [var] = NULL;
 #else /*SEPARATORCACHE*/
         s->pathwidth  [var] = 0;
         s->separators [var] = NULL;
@@ -1002,14 +1212,23 @@ static inline void solver_canceluntil(solver* s, int level) {
 
 #ifdef NONBLOCKING
     int sublevel;
-    lit t = s->trail[veci_begin(&s->trail_lim)[level]-1]; // the last literal at the target level
-    sublevel = level > s->root_level? s->sublevels[lit_var(t)] : level; // convert level to sublevel
+    if (level > s->root_level) {
+        lit t = s->trail[veci_begin(&s->trail_lim)[level]-1]; // the last literal at the target level
+        sublevel = s->sublevels[lit_var(t)]; // convert level to sublevel
+    } else
+        sublevel = level;
 #endif /*NONBLOCKING*/
 
     for (c = s->qtail-1; c >= bound; c--) {
         int     x  = lit_var(trail[c]);
         values [x] = l_Undef;
         reasons[x] = (clause*)0;
+#ifdef CUTSETCACHE
+        if (x < s->nkeys)
+            s->nkeys = x;
+        if (x <= s->lastkey)
+            s->lastkey = -1;
+#endif
     }
 
     for (c = s->qhead-1; c >= bound; c--)
@@ -1618,52 +1837,42 @@ void solver_reducedb(solver* s)
 }
 
 
-static void solver_extendobdd(solver* s, obdd_t* target)
+static void solver_extendobdd(solver* s, obdd_t target)
 {
-    lbool*  values   = s->assigns;
-    const int targetvar = (target == obdd_top()) ? s->size: obdd_label(target)-1;
-    obdd_t* p;
+    lbool*    values   = s->assigns;
+    obdd_mgr* m        = &s->ctx->obdd;
+    const int targetvar = (target == obdd_top(m)) ? s->size: obdd_label(m, target)-1;
+    obdd_t    p;
 
     // Go down to a leaf of OBDD according to the current assignment.
-    vecp_resize(&s->obddpath, 0);
+    veci_resize(&s->obddpath, 0);
     p = s->root;
     int i;
-    while (p != NULL && (i=obdd_label(p)-1) < targetvar) {
-        vecp_push(&s->obddpath, (void*)p);
-        p = (values[i] == l_False? p->lo: p->hi);
+    while (p != OBDD_NULL && (i=obdd_label(m, p)-1) < targetvar) {
+        veci_push(&s->obddpath, (int)p);
+        p = (values[i] == l_False? obdd_lo(m, p): obdd_hi(m, p));
     }
-    assert(vecp_size(&s->obddpath) > 0);
+    assert(veci_size(&s->obddpath) > 0);
 #ifdef NONBLOCKING
-    assert(p == NULL); // solutions never be rediscovered due to chronologcal backtracking.
+    assert(p == OBDD_NULL); // solutions never be rediscovered due to chronologcal backtracking.
 #endif
 
-    if (p == NULL) {
+    if (p == OBDD_NULL) {
         // Concatenate new nodes to OBDD.
-        p = vecp_begin(&s->obddpath)[vecp_size(&s->obddpath)-1];
-        vecp_resize(&s->obddpath, vecp_size(&s->obddpath)-1);
-        for (i=obdd_label(p)-1; i < targetvar; i++) {
-            vecp_push(&s->obddpath, (void*)p);
-            obdd_t* next = (i == targetvar-1? target: obdd_node(i+2, NULL, NULL));
+        p = (obdd_t)veci_begin(&s->obddpath)[veci_size(&s->obddpath)-1];
+        veci_resize(&s->obddpath, veci_size(&s->obddpath)-1);
+        for (i=obdd_label(m, p)-1; i < targetvar; i++) {
+            veci_push(&s->obddpath, (int)p);
+            obdd_t next = (i == targetvar-1? target: obdd_node(m, i+2, OBDD_NULL, OBDD_NULL));
             if (values[i] == l_False)  
-                p->lo = next;
+                obdd_setlo(m, p, next);
             else                      
-                p->hi = next;
+                obdd_sethi(m, p, next);
             p = next;
         }
-
-        // Update the aux field of each obdd node traversed above (this is for counting the number of solutions).
-        for (i = vecp_size(&s->obddpath)-1; i >= 0; i--) { 
-            p = (obdd_t*)vecp_begin(&s->obddpath)[i];
-            intptr_t nl = (p->lo != NULL? p->lo->aux: 0);
-            intptr_t nh = (p->hi != NULL? p->hi->aux: 0);
-            if (nl == INTPTR_MAX || nh == INTPTR_MAX || INTPTR_MAX - nl <= nh)  
-                p->aux = INTPTR_MAX; // overflow!
-            else                                                               
-                p->aux = nl+nh;
-        }
     }
 
-    vecp_push(&s->obddpath, target);
+    veci_push(&s->obddpath, (int)target);
 }
 
 
@@ -1888,7 +2097,7 @@ static lbool solver_search(solver* s, int nof_conflicts, int nof_learnts)
     s->cla_decay = (float)(1 / clause_decay);
 
     for (;;){
-		if (eflag == 1) return l_False;
+		if (s->ctx->eflag == 1) return l_False;
         clause* confl = solver_propagate(s);
         if (confl != 0) {
             // CONFLICT
@@ -1926,13 +2135,13 @@ static lbool solver_search(solver* s, int nof_conflicts, int nof_learnts)
 
             if (next == nvars) { // model found without cache
                 modelfound = true;
-                solver_extendobdd(s, obdd_top());
+                solver_extendobdd(s, obdd_top(&s->ctx->obdd));
             } else if (s->nextvar < next) {
                 unsigned int *vec = vecp_begin(&s->bitvecs)[next-1];
                 solver_makecache(s, vec, next-1);
-                obdd_t* lookup;
+                obdd_t lookup;
                 s->stats.ncachelookup++;
-                if ((lookup = (obdd_t*)trie_search(vec, s->cache[next-1])) != NULL) {
+                if ((lookup = (obdd_t)trie_search(vec, s->cache[next-1])) != OBDD_NULL) {
                     modelfound = true;
                     s->stats.ncachehits++;
                     solver_extendobdd(s, lookup);
@@ -1944,9 +2153,9 @@ static lbool solver_search(solver* s, int nof_conflicts, int nof_learnts)
                 unsigned int *vec = vecp_begin(&s->bitvecs)[next];
                 solver_makecache(s, vec, next);
 
-                obdd_t* lookup;
+                obdd_t lookup;
                 s->stats.ncachelookup++;
-                if ((lookup = (obdd_t*)trie_search(vec, s->cache[next])) != NULL) {
+                if ((lookup = (obdd_t)trie_search(vec, s->cache[next])) != OBDD_NULL) {
                     modelfound = true;
                     s->stats.ncachehits++;
                     solver_extendobdd(s, lookup);
@@ -1956,7 +2165,7 @@ static lbool solver_search(solver* s, int nof_conflicts, int nof_learnts)
 
             if (!modelfound && next == nvars-1 && values[next] != l_Undef)  { // model found without cache.
                 modelfound = true;
-                solver_extendobdd(s, obdd_top());
+                solver_extendobdd(s, obdd_top(&s->ctx->obdd));
             }
             s->nextvar = next;
 #endif
@@ -1971,7 +2180,7 @@ static lbool solver_search(solver* s, int nof_conflicts, int nof_learnts)
                 }
 
 #ifdef REFRESH
-                if (obdd_nnodes() + s->size > s->stats.maxnodes) 
+                if (obdd_nnodes(&s->ctx->obdd) + s->size > s->stats.maxnodes) 
                     solver_refreshobdd(s);
 #endif
 
@@ -2010,7 +2219,7 @@ static lbool solver_search(solver* s, int nof_conflicts, int nof_learnts)
     veci_new(&learnt_clause);
 
     for (;;){
-		if (eflag == 1) return l_False;
+		if (s->ctx->eflag == 1) return l_False;
         clause* confl = solver_propagate(s);
         if (confl != 0){
             // CONFLICT
@@ -2062,13 +2271,13 @@ static lbool solver_search(solver* s, int nof_conflicts, int nof_learnts)
 
             if (next == nvars) { // model found without cache
                 modelfound = true;
-                solver_extendobdd(s, obdd_top());
+                solver_extendobdd(s, obdd_top(&s->ctx->obdd));
             } else if (s->nextvar < next) {
                 unsigned int *vec = vecp_begin(&s->bitvecs)[next-1];
                 solver_makecache(s, vec, next-1);
-                obdd_t* lookup;
+                obdd_t lookup;
                 s->stats.ncachelookup++;
-                if ((lookup = (obdd_t*)trie_search(vec, s->cache[next-1])) != NULL) {
+                if ((lookup = (obdd_t)trie_search(vec, s->cache[next-1])) != OBDD_NULL) {
                     modelfound = true;
                     s->stats.ncachehits++;
                     solver_extendobdd(s, lookup);
@@ -2080,9 +2289,9 @@ static lbool solver_search(solver* s, int nof_conflicts, int nof_learnts)
                 unsigned int *vec = vecp_begin(&s->bitvecs)[next];
                 solver_makecache(s, vec, next);
 
-                obdd_t* lookup;
+                obdd_t lookup;
                 s->stats.ncachelookup++;
-                if ((lookup = (obdd_t*)trie_search(vec, s->cache[next])) != NULL) {
+                if ((lookup = (obdd_t)trie_search(vec, s->cache[next])) != OBDD_NULL) {
                     modelfound = true;
                     s->stats.ncachehits++;
                     solver_extendobdd(s, lookup);
@@ -2092,7 +2301,7 @@ static lbool solver_search(solver* s, int nof_conflicts, int nof_learnts)
 
             if (!modelfound && next == nvars-1 && values[next] != l_Undef)  { // model found without cache.
                 modelfound = true;
-                solver_extendobdd(s, obdd_top());
+                solver_extendobdd(s, obdd_top(&s->ctx->obdd));
             }
             s->nextvar = next;
 #endif
@@ -2136,14 +2345,20 @@ static lbool solver_search(solver* s, int nof_conflicts, int nof_learnts)
 //=================================================================================================
 // External solver functions:
 
-solver* solver_new(void)
+solver* solver_new(bddctx* ctx)
 {
     solver* s = (solver*)malloc(sizeof(solver));
+    s->ctx = ctx;
 
     // initialize vectors
     vecp_new(&s->clauses);
     vecp_new(&s->learnts);
     vecp_new(&s->persistents);
+    veci_new(&s->pers_lits);
+    vecp_new(&s->pers_watches);
+    veci_new(&s->pers_wsizes);
+    s->pers_nvars = 0;
+    arena_init(s);
     vecp_new(&s->bitvecs);
     veci_new(&s->order);
     veci_new(&s->trail_lim);
@@ -2155,7 +2370,7 @@ solver* solver_new(void)
     veci_new(&s->tagged);
     veci_new(&s->stack);
 
-    vecp_new(&s->obddpath);
+    veci_new(&s->obddpath);
 
     s->npers = 0;
     
@@ -2184,23 +2399,26 @@ solver* solver_new(void)
 
     // fields for obdd construction
     s->nextvar     = 0;
+    s->cachebudget = 0;
+    s->cachehand   = 0;
 #ifdef CUTSETCACHE
     s->maxcutwidth = 0;
     s->cutwidth    = NULL;
     s->cutsets     = NULL;
-    vecp_new(&s->toremove);
+    s->cutprev     = NULL;
+    s->cutlits     = NULL;
+    s->nkeys       = 0;
+    s->lastkey     = -1;
 #else /*SEPARATORCACHE*/
     s->maxpathwidth= 0;
     s->pathwidth   = NULL;
     s->separators  = NULL;
 #endif
     s->cache       = NULL;
-    s->root        = NULL;
+    s->root        = OBDD_NULL;
     s->trail       = NULL;
 
-    s->root         = obdd_node(1, NULL, NULL); 
-    obdd_top()->aux = (intptr_t)1;
-    obdd_bot()->aux = (intptr_t)0;
+    s->root         = obdd_node(&s->ctx->obdd, 1, OBDD_NULL, OBDD_NULL); 
 
     // initialize other vars
     s->size                   = 0;
@@ -2234,6 +2452,8 @@ solver* solver_new(void)
 
     s->stats.ncachehits       = 0;
     s->stats.ncachelookup     = 0;
+    s->stats.ncacheevictions  = 0;
+    s->stats.maxcachebytes    = 0;
 
     s->stats.tot_solutions  = 0; 
 #ifdef GMP
@@ -2244,62 +2464,45 @@ solver* solver_new(void)
     return s;
 }
 
+// Called right after the persistent clauses are added: solver_reset()
+// restores them from the copy taken here, watch lists included.
 void solver_setpersistent(solver * s)
 {
+  int i, j;
   s->npers = vecp_size(&s->clauses);
-}
-
-int solver_npersistent(solver * s)
-{
-  return s->npers;
-}
+  arena_setmark(s);
 
-void solver_addpersistent(solver * s, clause * c)
-{
-  int size = clause_size(c);
-  lit * begin = clause_begin(c);
-  lit * end = begin + size;
-  int maxvar;
-  lit * i;
-  
-  maxvar = lit_var(*begin);
-  for (i = begin + 1; i < end; i++){
-    lit l = *i;
-    maxvar = lit_var(l) > maxvar ? lit_var(l) : maxvar;
-  }
-  solver_setnvars(s,maxvar+1);
+  vecp_resize(&s->persistents, 0);
+  veci_resize(&s->pers_lits, 0);
+  for (i = 0; i < s->npers; i++)
+    {
+      clause* c = vecp_begin(&s->clauses)[i];
+      vecp_push(&s->persistents, c);
+      for (j = 0; j < clause_size(c); j++)
+	veci_push(&s->pers_lits, clause_begin(c)[j]);
+    }
 
-  vecp_push(solver_read_wlist(s,lit_neg(begin[0])),(void*)(size > 2 ? c : clause_from_lit(begin[1])));
-  vecp_push(solver_read_wlist(s,lit_neg(begin[1])),(void*)(size > 2 ? c : clause_from_lit(begin[0])));
+  vecp_resize(&s->pers_watches, 0);
+  veci_resize(&s->pers_wsizes, 0);
+  for (i = 0; i < s->size*2; i++)
+    {
+      vecp* ws = solver_read_wlist(s, i);
+      for (j = 0; j < vecp_size(ws); j++)
+	vecp_push(&s->pers_watches, vecp_begin(ws)[j]);
+      veci_push(&s->pers_wsizes, vecp_size(ws));
+    }
+  s->pers_nvars = s->size;
 }
 
-void solver_removepersistent(solver * s, clause * c)
+int solver_npersistent(solver * s)
 {
-  lit* lits = clause_begin(c);
-  assert(lit_neg(lits[0]) < s->size*2);
-  assert(lit_neg(lits[1]) < s->size*2);
-
-  //vecp_remove(solver_read_wlist(s,lit_neg(lits[0])),(void*)c);
-  //vecp_remove(solver_read_wlist(s,lit_neg(lits[1])),(void*)c);
-
-  assert(lits[0] < s->size*2);
-  vecp_remove(solver_read_wlist(s,lit_neg(lits[0])),(void*)(clause_size(c) > 2 ? c : clause_from_lit(lits[1])));
-  vecp_remove(solver_read_wlist(s,lit_neg(lits[1])),(void*)(clause_size(c) > 2 ? c : clause_from_lit(lits[0])));
-
-  s->stats.clauses--;
-  s->stats.clauses_literals -= clause_size(c);
-
-  vecp_push(&s->persistents, c);
+  return s->npers;
 }
 
 void solver_reset(solver * s)
 {
     int i;
-    for (i = s->npers; i < vecp_size(&s->clauses); i++)
-        free(vecp_begin(&s->clauses)[i]);
-
-    for (i = 0; i < vecp_size(&s->learnts); i++)
-        free(vecp_begin(&s->learnts)[i]);
+    arena_rewind(s); // non-persistent and learnt clauses
 
 #ifdef NONBLOCKING
     for (i = 0; i < vecp_size(&s->generated_clauses); i++) {
@@ -2317,7 +2520,7 @@ void solver_reset(solver * s)
     vecp_resize(&s->clauses, s->npers);    
     vecp_resize(&s->learnts, 0);
     vecp_resize(&s->bitvecs, 0);
-    vecp_resize(&s->obddpath, 0);
+    veci_resize(&s->obddpath, 0);
     veci_resize(&s->order, 0);
     veci_resize(&s->trail_lim, 0);
 #ifdef NONBLOCKING
@@ -2346,24 +2549,24 @@ void solver_reset(solver * s)
 
     s->stats.clk       = (clock_t)0;
     s->nextvar     = 0;
+    s->cachehand   = 0;
 
 #ifdef CUTSETCACHE
 
     for (int i = 0; i < s->size; i++) {
       free(s->cutsets[i]);
       s->cutsets[i] = NULL;
+      free(s->cutprev[i]);
+      s->cutprev[i] = NULL;
+      free(s->cutlits[i]);
+      s->cutlits[i] = NULL;
       s->cutwidth[i] = 0;
     }
+    s->nkeys = 0;
+    s->lastkey = -1;
 
     s->maxcutwidth = 0;
     
-    /* Added by Milan Bankovic (memory leak patch) */
-    for(int i = 0; i < vecp_size(&s->toremove); i++)
-      {
-	free(vecp_begin(&s->toremove)[i]);
-      }
-    vecp_resize(&s->toremove, 0);
-    
 #else /*SEPARATORCACHE*/
     for (int i = 0; i < s->size; i++) {
       free(s->separators[i]);
@@ -2378,11 +2581,9 @@ void solver_reset(solver * s)
 	trie_delete(s->cache[i]);
 	s->cache[i] = NULL;
       }
-    trie_finalize();
+    // the trie pools are kept, and rewound by the next trie_initialize
 
-    s->root         = obdd_node(1, NULL, NULL); 
-    obdd_top()->aux = (intptr_t)1;
-    obdd_bot()->aux = (intptr_t)0;
+    s->root         = obdd_node(&s->ctx->obdd, 1, OBDD_NULL, OBDD_NULL); 
 
     // initialize other vars
     s->size                   = 0;
@@ -2416,6 +2617,8 @@ void solver_reset(solver * s)
 
     s->stats.ncachehits       = 0;
     s->stats.ncachelookup     = 0;
+    s->stats.ncacheevictions  = 0;
+    s->stats.maxcachebytes    = 0;
 
     s->stats.tot_solutions  = 0; 
 #ifdef GMP
@@ -2423,36 +2626,38 @@ void solver_reset(solver * s)
     mpz_set_ui(s->stats.tot_solutions_gmp, 0); 
 #endif
 
-    for(i = 0; i < vecp_size(&s->clauses); i++)
-      {	
-	solver_addpersistent(s, vecp_begin(&s->clauses)[i]);   
-	s->stats.clauses++;
-	s->stats.clauses_literals += clause_size(vecp_begin(&s->clauses)[i]);
-      }
-    
+    // restore the persistent clauses and their watches as they were at solver_setpersistent()
+    solver_setnvars(s, s->pers_nvars);
+
+    lit* pl = veci_begin(&s->pers_lits);
+    vecp_resize(&s->clauses, 0);
     for(i = 0; i < vecp_size(&s->persistents); i++)
       {
-	solver_addpersistent(s, vecp_begin(&s->persistents)[i]);
-	vecp_push(&s->clauses, vecp_begin(&s->persistents)[i]);
+	clause* c = vecp_begin(&s->persistents)[i];
+	memcpy(clause_begin(c), pl, sizeof(lit)*clause_size(c));
+	pl += clause_size(c);
+	vecp_push(&s->clauses, c);
 	s->stats.clauses++;
-	s->stats.clauses_literals += clause_size(vecp_begin(&s->persistents)[i]);
-	s->npers++;
+	s->stats.clauses_literals += clause_size(c);
+      }
+    s->npers = vecp_size(&s->persistents);
+
+    void** pw = vecp_begin(&s->pers_watches);
+    for(i = 0; i < veci_size(&s->pers_wsizes); i++)
+      {
+	vecp* ws = solver_read_wlist(s, i);
+	int   n  = veci_begin(&s->pers_wsizes)[i];
+	for(int j = 0; j < n; j++)
+	  vecp_push(ws, pw[j]);
+	pw += n;
       }
-    vecp_resize(&s->persistents, 0);
 }
 
 void solver_delete(solver* s)
 {
     int i;
-    for (i = 0; i < vecp_size(&s->clauses); i++)
-      free(vecp_begin(&s->clauses)[i]);
+    arena_delete(s); // all clauses
 
-    for (i = 0; i < vecp_size(&s->learnts); i++)
-        free(vecp_begin(&s->learnts)[i]);
-
-    for(i = 0; i < vecp_size(&s->persistents); i++)
-      free(vecp_begin(&s->persistents)[i]);
-    
 #ifdef NONBLOCKING
     for (i = 0; i < vecp_size(&s->generated_clauses); i++) {
         veci_delete(vecp_begin(&s->generated_clauses)[i]);
@@ -2467,8 +2672,11 @@ void solver_delete(solver* s)
     vecp_delete(&s->clauses);
     vecp_delete(&s->learnts);
     vecp_delete(&s->persistents);
+    veci_delete(&s->pers_lits);
+    vecp_delete(&s->pers_watches);
+    veci_delete(&s->pers_wsizes);
     vecp_delete(&s->bitvecs);
-    vecp_delete(&s->obddpath);
+    veci_delete(&s->obddpath);
     veci_delete(&s->order);
     veci_delete(&s->trail_lim);
 #ifdef NONBLOCKING
@@ -2507,15 +2715,14 @@ void solver_delete(solver* s)
 #ifdef CUTSETCACHE
     for (int i = 0; i < s->size; i++) {
         free(s->cutsets[i]);
+        free(s->cutprev[i]);
+        free(s->cutlits[i]);
     }
     free(s->cutsets);
+    free(s->cutprev);
+    free(s->cutlits);
     free(s->cutwidth);
 
-    /* Added by Milan Bankovic (memory leak patch) */
-    for(int i = 0; i < vecp_size(&s->toremove); i++)
-      free(vecp_begin(&s->toremove)[i]);
-    vecp_delete(&s->toremove);
-    
 #else /*SEPARATORCACHE*/
     for (int i = 0; i < s->size; i++) {
         free(s->separators[i]);
@@ -2526,7 +2733,7 @@ void solver_delete(solver* s)
 
     for (int i = 0; i < s->size; i++) 
         trie_delete(s->cache[i]);
-    trie_finalize();
+    trie_finalize(&s->ctx->trie);
     free(s->cache); // ADDED: by Milan Bankovic (memory leak patch)
     
     free(s);
@@ -2590,6 +2797,7 @@ bool   solver_simplify(solver* s)
 {
     clause** reasons;
     int type;
+    int removed = 0;
 
     assert(solver_dlevel(s) == 0);
 
@@ -2611,24 +2819,18 @@ bool   solver_simplify(solver* s)
                 clause_simplify(s,cls[i]) == l_True) {
 
 	      if(cs == &s->clauses && i < s->npers)
-	      	{
-	      	  solver_removepersistent(s, cls[i]);
-		  pers_removed++;
-	      	  continue;
-	      	}
-	      
-#ifdef CUTSETCACHE // original clauses must not be removed from memory because cutset caching is based on clause evaluation.
-                if(cs == &s->clauses) clause_remove_nofree(s,cls[i]);
-                else                  clause_remove(s,cls[i]);
-#else /*SEPARATORCACHE*/
-                clause_remove(s,cls[i]);
-#endif
+		pers_removed++;
+	      // The clause stays in the arena: cutset caching evaluates original clauses.
+	      clause_forget(s,cls[i]);
+	      removed++;
             } else
                 cls[j++] = cls[i];
         }	
         vecp_resize(cs,j);
 	s->npers -= pers_removed;
     }
+    if (removed > 0)
+        solver_detachsatisfied(s);
 
     s->simpdb_assigns = s->qhead;
     // (shouldn't depend on 'stats' really, but it will do for now)
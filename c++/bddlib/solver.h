@@ -66,12 +66,23 @@ static inline int  lit_sign(lit l) { return (l & 1); }
 //=================================================================================================
 // Public interface:
 
-extern volatile sig_atomic_t eflag;
+// State that used to be global: a solver only touches the context it was
+// created with, so solvers with different contexts can run in parallel.
+struct bddctx_t
+{
+    obdd_mgr obdd;          // obdd nodes and terminals
+    trie_mgr trie;          // trie node pools of the caches
+    volatile sig_atomic_t eflag; // set to interrupt the search
+};
+typedef struct bddctx_t bddctx;
+
+extern bddctx* bddctx_new(void);
+extern void    bddctx_delete(bddctx* ctx);
 
 struct solver_t;
 typedef struct solver_t solver;
 
-extern solver* solver_new(void);
+extern solver* solver_new(bddctx* ctx);
 extern void    solver_delete(solver* s);
 
 extern bool    solver_addclause(solver* s, lit* begin, lit* end);
@@ -84,12 +95,19 @@ extern int     solver_nconflicts(solver* s);
 
 extern void    solver_setnvars(solver* s,int n);
 
+// The caches of the levels are evicted (the ones not hit lately first)
+// whenever they take more than bytes; 0 means no limit. The obdd nodes
+// are not counted.
+extern void    solver_setcachebudget(solver* s, size_t bytes);
+
 extern void totalup_stats(solver *s);
 
 struct stats_t
 {
     uint64   starts, decisions, propagations, inspects, conflicts;
     uint64   ncachelookup, ncachehits;
+    uint64   ncacheevictions; // caches of levels evicted to keep the budget
+    uint64   maxcachebytes; // the most bytes taken by the caches
     uint64   clauses, clauses_literals, learnts, learnts_literals, max_literals, tot_literals;
     uint64   tot_solutions;
 #ifdef GMP
@@ -121,8 +139,22 @@ struct solver_t
     vecp     clauses;       // List of problem constraints. (contains: clause*)
     vecp     learnts;       // List of learnt clauses. (contains: clause*)
 
-    vecp     persistents;
+    vecp     persistents;   // persistent clauses, as at solver_setpersistent() (contains: clause*)
+    veci     pers_lits;     // their literals, in the same order
+    vecp     pers_watches;  // watch lists at solver_setpersistent(), concatenated (contains: clause*)
+    veci     pers_wsizes;   // sizes of these watch lists
+    int      pers_nvars;    // number of variables at solver_setpersistent()
     int      npers;
+
+    // clause arena: clauses are carved out of blocks, and the ones created
+    // after solver_setpersistent() are released at once by solver_reset().
+    vecp     blocks;        // (contains: char*)
+    int      block;         // index of the current block
+    int      blockpos;      // first free byte of the current block
+    int      mark_block;    // arena position at solver_setpersistent()
+    int      mark_blockpos; //
+    vecp     large;         // clauses that do not fit in a block (contains: clause*)
+    int      mark_large;    //
   
     // activities
     double   var_inc;       // Amount to bump next variable with.
@@ -139,13 +171,17 @@ struct solver_t
     lit*     trail;
 
     // fields for obdd construction (added)
+    bddctx*     ctx;        // context holding the obdd nodes and the caches
     int         nextvar;    // variable to be considered next  
-    obdd_t*     root;       // root node of an obdd to be constructed
+    obdd_t      root;       // root node of an obdd to be constructed
 #ifdef CUTSETCACHE
     int*        cutwidth;   // Cusetset sizes
     int         maxcutwidth;// maximum size of a cutset 
     clause***   cutsets;    //
-    vecp        toremove;  // Added by Milan Bankovic 
+    int**       cutprev;    // positions of the cutset clauses in the cutset of the previous variable (-1 if they start here)
+    lit**       cutlits;    // literals of the variable in the cutset clauses (lit_Undef if it does not occur)
+    int         nkeys;      // the cache keys (bitvecs) of the variables below are up to date
+    int         lastkey;    // the cache key of this variable is up to date as well (-1 if none)
 #else /*SEPARATORCACHE*/
     int*        pathwidth;  // Separator sizes
     int         maxpathwidth;// maximum size of a separator
@@ -154,7 +190,9 @@ struct solver_t
     trie_t**      cache;      // Binary Trie whose leaves are associated with obdd nodes.
     vecp        bitvecs;    // vectors for cache lookup
     veci        cachedvars; // variables at which caches were inserted
-    vecp        obddpath;   // traversed obdd nodes
+    veci        obddpath;   // traversed obdd nodes
+    size_t      cachebudget;// bytes that the caches may take, or 0 if unlimited
+    int         cachehand;  // level at which the eviction clock continues
 
 #ifdef NONBLOCKING
     FILE*    out;           //
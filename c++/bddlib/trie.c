@@ -10,6 +10,10 @@
 #include "my_def.h"
 #include "trie.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define IS_EXT(h)   ((uintptr_t)(h)%2 == 1)
 #define LEFT(h)     (((st_node*)(((uintptr_t)(h) / 2) * 2))->l)
 #define RIGHT(h)    (((st_node*)(((uintptr_t)(h) / 2) * 2))->r)
@@ -22,135 +26,151 @@ struct trie_node {
     struct  trie_node  *r;
 };
 
+struct st_trie_chunk {
+    trie_chunk* nx;     // next chunk of the same trie, or of the same spare list
+    size_t      size;   // bytes that follow the header
+    size_t      pos;    // first free byte
+    int         cls;    // size class: size == chunk_min << cls
+};
+
 static int        isequal       (unsigned int *k1, unsigned int *k2, int len);
-static st_node    *trie_getnode (int len, unsigned int *k, uintptr_t v);
-static st_node    *trie_split   (st_node *p, st_node *q, int w);
+static st_node    *trie_getnode (trie_t *tr, int len, unsigned int *k, uintptr_t v);
+static st_node    *trie_split   (trie_t *tr, st_node *p, st_node *q, int w);
 #ifdef TRIE_REC
-static st_node    *trie_insertR (unsigned int *k, int w, int len, uintptr_t v, st_node *h);
+static st_node    *trie_insertR (trie_t *tr, unsigned int *k, int w, int len, uintptr_t v, st_node *h);
 static uintptr_t  trie_searchR  (unsigned int *k, int w, int len, st_node *h);
 static int        trie_printR   (int c, st_node *h, FILE *out);
 #endif
 
-#define FN_INIT_X   (1UL << 10)
-#define VECS_INIT_X (1UL << 10)
-
-static trie_t *trielist = NULL;
+static const size_t     chunk_min = 1UL << 10;
+static const int        grow_max_cls  = 6;  // chunks of a trie grow up to 64KB
+static const int        trim_interval = 64; // resets between two trims of unused chunks
 
-static st_node**        fn       = NULL;
-static uintptr_t        fn_x     = 0;
-static uintptr_t        fn_y     = 0;
-static uintptr_t        fn_max_x = FN_INIT_X;
-static const uintptr_t  fn_max_y = 64;
 
-static unsigned int**   vecs        = NULL;
-static uintptr_t        vecs_x      = 0;
-static uintptr_t        vecs_y      = 0;
-static uintptr_t        vecs_max_x  = VECS_INIT_X;
-static const uintptr_t  vecs_max_y  = 64;
+/* \brief Return the chunks of t to the spare lists of its manager.
+ */
+static void trie_release(trie_t *t)
+{
+    trie_mgr *m = t->mgr;
+    while (t->chunks != NULL) {
+        trie_chunk *c = t->chunks;
+        t->chunks = c->nx;
+        c->nx = m->spare[c->cls];
+        m->spare[c->cls] = c;
+        m->inuse -= c->size;
+    }
+    t->root = (st_node*)((uintptr_t)NULL + 1);
+    t->ref  = 0;
+}
 
 
 /* \brief Setup node management. If tries are already created, they are initialized.
  * \note 
- * - Call pior to any other function calls. 
+ * - Call pior to any other function calls. m must be zero-filled before the first call.
  * - This can be also used to clear all existing tries, where length of each trie will not be changed.
+ * - Chunks allocated before are kept for reuse, except for those not used lately.
  */
-extern void trie_initialize(void)
+extern void trie_initialize(trie_mgr *m)
 {
-    if (fn != NULL || vecs != NULL)
-        trie_finalize();
-
-    fn_x = 0;
-    fn_y = 0;
-    fn_max_x = FN_INIT_X;
-    fn = (st_node**)malloc(sizeof(st_node*)*fn_max_y);
-    ENSURE_TRUE_MSG(fn != NULL, "memory allocation failed");
-    for (int i = 0; i < fn_max_y; i++)
-        fn[i] = NULL;
-    fn[0] = (st_node*)malloc(sizeof(st_node)*fn_max_x);
-    ENSURE_TRUE_MSG(fn[0] != NULL, "memory allocation failed");
-
-    vecs_x = 0;
-    vecs_y = 0;
-    vecs_max_x = VECS_INIT_X;
-    vecs = (unsigned int**)malloc(sizeof(unsigned int*)*vecs_max_y);
-    ENSURE_TRUE_MSG(vecs != NULL, "memory allocation failed");
-    for (int i = 0; i < vecs_max_y; i++)
-        vecs[i] = NULL;
-    vecs[0] = (unsigned int*)malloc(sizeof(unsigned int)*vecs_max_x);
-    ENSURE_TRUE_MSG(vecs[0] != NULL, "memory allocation failed");
-
-    for (trie_t *p = trielist; p != NULL; p = p->nx) {
-        p->root = (st_node*)((uintptr_t)NULL + 1);
+    if (m->inuse > m->hwm)
+        m->hwm = m->inuse;
+
+    for (trie_t *p = m->trielist; p != NULL; p = p->nx)
+        trie_release(p);
+
+    if (++m->nresets >= trim_interval) {
+        trie_trim(m, m->hwm);
+        m->hwm     = 0;
+        m->nresets = 0;
     }
 }
 
 
 /* \brief Finalize node management.
  * \note
- * - trie nodes and bit vectors are cleared.
+ * - trie nodes and bit vectors are cleared, and all chunks are freed.
  * - trie_t data structure is not cleared for a later use!
  * - Call trie_delete to destroy trie_t data structure.
  */
-extern void trie_finalize(void)
+extern void trie_finalize(trie_mgr *m)
 {
-    if (fn != NULL) {
-        for (int i = 0; i < fn_max_y; i++) {
-            if (fn[i] != NULL) {
-                free(fn[i]);
-                fn[i] = NULL;
-            }
-        }
-        free(fn);
-        fn = NULL;
-    }
+    for (trie_t *p = m->trielist; p != NULL; p = p->nx)
+        trie_release(p);
+    trie_trim(m, 0);
+
+    m->hwm     = 0;
+    m->nresets = 0;
+}
 
 
-    if (vecs != NULL) {
-        for (int i = 0; i < vecs_max_y; i++) {
-            if (vecs[i] != NULL) {
-                free(vecs[i]);
-                vecs[i] = NULL;
-            }
+void trie_trim(trie_mgr *m, size_t limit)
+{
+    for (int i = TRIE_NCLASSES-1; i >= 0 && m->nbytes > limit; i--) {
+        while (m->spare[i] != NULL && m->nbytes > limit) {
+            trie_chunk *c = m->spare[i];
+            m->spare[i] = c->nx;
+            m->nbytes -= c->size;
+            free(c);
         }
-        free(vecs);
-        vecs = NULL;
     }
 }
 
 
-static inline st_node *get_freenode(void)
+void trie_clear(trie_t *t)
+{
+    trie_release(t);
+}
+
+
+/* \brief Get n bytes from the current chunk of t, where a new chunk is taken if it is full.
+ */
+static inline void *trie_alloc(trie_t *t, size_t n)
 {
-    if (fn_x >= fn_max_x) {
-        fn_max_x *= 2;
-        fn_x = 0;
-        fn_y++;
-        assert(fn_y < fn_max_y);
-        fn[fn_y] = (st_node*)malloc(sizeof(st_node)*fn_max_x);
-        ENSURE_TRUE_MSG(fn[fn_y] != NULL, "memory allocation failed");
+    n = (n + sizeof(st_node) - 1) / sizeof(st_node) * sizeof(st_node); // keeps nodes aligned
+    trie_chunk *c = t->chunks;
+
+    if (c == NULL || c->pos + n > c->size) {
+        trie_mgr *m = t->mgr;
+        int cls = c == NULL? 0: (c->cls < grow_max_cls? c->cls+1: c->cls);
+        while ((chunk_min << cls) < n)
+            cls++;
+        ENSURE_TRUE_MSG(cls < TRIE_NCLASSES, "too long bit vector");
+
+        c = m->spare[cls];
+        if (c != NULL) {
+            m->spare[cls] = c->nx;
+        } else {
+            c = (trie_chunk*)malloc(sizeof(trie_chunk) + (chunk_min << cls));
+            ENSURE_TRUE_MSG(c != NULL, "memory allocation failed");
+            c->size = chunk_min << cls;
+            c->cls  = cls;
+            m->nbytes += c->size;
+        }
+        c->pos = 0;
+        c->nx  = t->chunks;
+        t->chunks = c;
+        m->inuse += c->size;
     }
 
-    return &(fn[fn_y][fn_x++]);
+    void *p = (char*)(c+1) + c->pos;
+    c->pos += n;
+    return p;
 }
 
 
-static inline unsigned int *get_freevec(int n)
+static inline st_node *get_freenode(trie_t *t)
 {
-    if (vecs_x+n >= vecs_max_x) {
-        vecs_max_x *= 2;
-        vecs_x = 0;
-        vecs_y++;
-        assert(vecs_y < vecs_max_y);
-        vecs[vecs_y] = (unsigned int*)malloc(sizeof(unsigned int)*vecs_max_x);
-        ENSURE_TRUE_MSG(vecs[vecs_y] != NULL, "memory allocation failed");
-    }
+    return (st_node*)trie_alloc(t, sizeof(st_node));
+}
 
-    unsigned int *t = &(vecs[vecs_y][vecs_x]);
-    vecs_x += n;
-    return t;
+
+static inline unsigned int *get_freevec(trie_t *t, int n)
+{
+    return (unsigned int*)trie_alloc(t, sizeof(unsigned int)*n);
 }
 
 
-/*  \brief  Decide if k1 == k2.
+/*  \brief  Decide if k1 == k2, comparing 128 bits at a time if SSE2 is available.
  *  \param  k1    Bitvector
  *  \param  k2    Bitvector
  *  \param  len   Bit length
@@ -159,8 +179,16 @@ static inline unsigned int *get_freevec(int n)
 static int isequal(unsigned int *k1, unsigned int *k2, int len)
 {
     const int nwords = GET_NWORDS(len);
+    int i = 0;
 
-    for (int i = 0; i < nwords; i++) {
+#ifdef __SSE2__
+    for (; i+4 <= nwords; i += 4) {
+        __m128i d = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(k1+i)), _mm_loadu_si128((const __m128i*)(k2+i)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(d, _mm_setzero_si128())) != 0xFFFF)
+            return 0;
+    }
+#endif
+    for (; i < nwords; i++) {
         if (k1[i] != k2[i]) 
             return 0;
     }
@@ -175,17 +203,17 @@ static int isequal(unsigned int *k1, unsigned int *k2, int len)
  *  \param  v   Value associated with the bitvector.
  *  \return Pointer to an obtained trie node.
  */
-static st_node *trie_getnode(int len, unsigned int *k, uintptr_t v)
+static st_node *trie_getnode(trie_t *tr, int len, unsigned int *k, uintptr_t v)
 {
-    st_node *p = get_freenode();
-    st_node *t = get_freenode();
+    st_node *p = get_freenode(tr);
+    st_node *t = get_freenode(tr);
 
     p->l = (st_node*)((uintptr_t)(t)+1); // left child holds a key-value pair.
     p->r = (st_node*)1;
 
     if(len > 0) {
         const int nwords  = GET_NWORDS(len);
-        unsigned int *vec = get_freevec(nwords);
+        unsigned int *vec = get_freevec(tr, nwords);
         for(int j = 0; j < nwords; j++) 
             vec[j] = k[j];
         t->l = (st_node*)(vec);
@@ -203,15 +231,15 @@ static st_node *trie_getnode(int len, unsigned int *k, uintptr_t v)
  *  \param  q   Trie node
  *  \param  w   Position in a bitvector
  */
-static st_node *trie_split(st_node *p, st_node *q, int w)
+static st_node *trie_split(trie_t *tr, st_node *p, st_node *q, int w)
 #ifdef TRIE_REC
 {
-    st_node *t = trie_getnode(0, (unsigned int*)NULL, (uintptr_t)NULL);
+    st_node *t = trie_getnode(tr, 0, (unsigned int*)NULL, (uintptr_t)NULL);
     switch (DIGIT(KEY(p), w)*2 + DIGIT(KEY(q), w)) {
-        case 0:  t->l = trie_split(p,q,w+1); break;
+        case 0:  t->l = trie_split(tr, p,q,w+1); break;
         case 1:  t->l = p; t->r =q;          break;
         case 2:  t->l = q; t->r =p;          break;
-        case 3:  t->r = trie_split(p,q,w+1); break;
+        case 3:  t->r = trie_split(tr, p,q,w+1); break;
     }
     return t;
 }
@@ -222,7 +250,7 @@ static st_node *trie_split(st_node *p, st_node *q, int w)
     int sgn = 0;
 
     for (int i = w; 1; i++) {
-        st_node *t = trie_getnode(0, (unsigned int*)NULL, (uintptr_t)NULL);
+        st_node *t = trie_getnode(tr, 0, (unsigned int*)NULL, (uintptr_t)NULL);
         if (sgn)
             prev->l = t;
         else
@@ -247,18 +275,21 @@ static st_node *trie_split(st_node *p, st_node *q, int w)
  * \return  Created trie.
  * \note Make sure that trie_initialize is done.
  */
-trie_t *trie_create(int n)
+trie_t *trie_create(trie_mgr *m, int n)
 {
     trie_t *t = (trie_t*)malloc(sizeof(trie_t));
     ENSURE_TRUE_MSG(t != NULL, "memory allocation failed");
 
-    t->root = (st_node*)((uintptr_t)NULL + 1);
-    t->len  = n;
-    if (trielist != NULL)
-        trielist->pv = t; 
-    t->nx = (trie_t*)trielist;
+    t->root   = (st_node*)((uintptr_t)NULL + 1);
+    t->len    = n;
+    t->mgr    = m;
+    t->chunks = NULL;
+    t->ref    = 0;
+    if (m->trielist != NULL)
+        m->trielist->pv = t; 
+    t->nx = (trie_t*)m->trielist;
     t->pv = NULL;
-    trielist = t;
+    m->trielist = t;
 
     return t;
 }
@@ -270,10 +301,12 @@ trie_t *trie_create(int n)
 void trie_delete(trie_t *t)
 {
     if (t != NULL) {
+        trie_release(t);
+
         if (t->pv != NULL)
             t->pv->nx = t->nx;
         else
-            trielist = t->nx;
+            t->mgr->trielist = t->nx;
 
         if (t->nx != NULL)
             t->nx->pv = t->pv;
@@ -297,7 +330,7 @@ void trie_insert(unsigned int *k, uintptr_t v, trie_t *t)
   //printf("\n");fflush(stdout);
 
 #ifdef TRIE_REC
-    t->root = trie_insertR(k, 0, t->len, v, t->root);
+    t->root = trie_insertR(t, k, 0, t->len, v, t->root);
 
 #else /*TRIE_ITERATION*/
     st_node *h = t->root;
@@ -311,17 +344,17 @@ void trie_insert(unsigned int *k, uintptr_t v, trie_t *t)
     for (int w = 0; 1; w++) {
         if (IS_EXT(h)) {
             if(sgn)
-                prev->l = trie_getnode(len, k, v);
+                prev->l = trie_getnode(t, len, k, v);
             else
-                prev->r = trie_getnode(len, k, v);
+                prev->r = trie_getnode(t, len, k, v);
             break;
         }
 
         if (IS_EXT(LEFT(h)) && IS_EXT(RIGHT(h))) {
             if (sgn)
-                prev->l = (!isequal(k, KEY(h),len))? trie_split(trie_getnode(len, k,v), h, w): h;
+                prev->l = (!isequal(k, KEY(h),len))? trie_split(t, trie_getnode(t, len, k,v), h, w): h;
             else
-                prev->r = (!isequal(k, KEY(h),len))? trie_split(trie_getnode(len, k,v), h, w): h;
+                prev->r = (!isequal(k, KEY(h),len))? trie_split(t, trie_getnode(t, len, k,v), h, w): h;
             break;
         }
 
@@ -341,22 +374,22 @@ void trie_insert(unsigned int *k, uintptr_t v, trie_t *t)
 
 
 #ifdef TRIE_REC
-static st_node *trie_insertR(unsigned int *k, int w, int len, uintptr_t v, st_node *h)
+static st_node *trie_insertR(trie_t *tr, unsigned int *k, int w, int len, uintptr_t v, st_node *h)
 {
     if (IS_EXT(h))
-        return trie_getnode(len, k, v);
+        return trie_getnode(tr, len, k, v);
 
     if (IS_EXT(LEFT(h)) && IS_EXT(RIGHT(h))) {
         if (!isequal(k, KEY(h), len))  
-            return trie_split(trie_getnode(len, k,v), h, w);
+            return trie_split(tr, trie_getnode(tr, len, k,v), h, w);
         else
             return h;
     }
 
     if (DIGIT(k, w) == 0)  
-        h->l = trie_insertR(k, w+1, len, v, LEFT(h));
+        h->l = trie_insertR(tr, k, w+1, len, v, LEFT(h));
     else
-        h->r = trie_insertR(k, w+1, len, v, RIGHT(h));
+        h->r = trie_insertR(tr, k, w+1, len, v, RIGHT(h));
 
   return h;
 }
@@ -376,7 +409,10 @@ uintptr_t trie_search(unsigned int *k, trie_t *t)
   //printf("\n");fflush(stdout);
 
 #ifdef TRIE_REC
-  return trie_searchR(k, 0, t->len, t->root);
+  uintptr_t v = trie_searchR(k, 0, t->len, t->root);
+  if (v != (uintptr_t)NULL)
+      t->ref = 1;
+  return v;
 
 #else /*TRIE_ITERATION*/
     st_node *h = t->root;
@@ -385,8 +421,12 @@ uintptr_t trie_search(unsigned int *k, trie_t *t)
         if (IS_EXT(h))
             return (uintptr_t)NULL;
 
-        if (IS_EXT(LEFT(h)) && IS_EXT(RIGHT(h)))
-            return isequal(k, KEY(h), t->len)? VAL(h): (uintptr_t)NULL;
+        if (IS_EXT(LEFT(h)) && IS_EXT(RIGHT(h))) {
+            if (!isequal(k, KEY(h), t->len))
+                return (uintptr_t)NULL;
+            t->ref = 1;
+            return VAL(h);
+        }
 
         h = DIGIT(k, w) == 0? LEFT(h): RIGHT(h);
     }
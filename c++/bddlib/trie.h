@@ -9,6 +9,7 @@
 #define TRIE_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include <assert.h>
 
 #define WORDSIZE   (sizeof(unsigned int)*8)
@@ -25,14 +26,34 @@ static inline void UNSET_ALL_DIGIT  (unsigned int *v, int len) {int size = GET_N
 
 typedef struct trie_node st_node;
 
+typedef struct st_trie_mgr trie_mgr;
+
+/* \brief  memory chunk from which the nodes and bit vectors of one trie are taken.*/
+typedef struct st_trie_chunk trie_chunk;
+
 /* \brief  trie*/
 typedef struct st_trie {
     int             len;    //!< length of a bitvector
     st_node*        root;   //!< root node of a trie
+    trie_mgr*       mgr;    //!< manager whose chunks hold the nodes of a trie
+    trie_chunk*     chunks; //!< chunks held by a trie, the one in use first
+    int             ref;    //!< set by a successful search (the caller may clear it, e.g. for eviction)
     struct st_trie* nx;     //!< used for memory management purpose
     struct st_trie* pv;     //!< used for memory management purpose
 } trie_t;
 
+#define TRIE_NCLASSES 16    //!< number of chunk sizes, which are 1KB times powers of two
+
+/* \brief  chunks of the tries of one manager, which must not be shared between threads.*/
+struct st_trie_mgr {
+    trie_t*         trielist;   //!< tries created by the manager
+    trie_chunk*     spare[TRIE_NCLASSES]; //!< chunks released by tries and kept for reuse, by size
+    size_t          inuse;      //!< bytes of the chunks held by tries
+    size_t          nbytes;     //!< bytes of all chunks, including spare ones
+    size_t          hwm;        //!< the most bytes in use since the last trim
+    int             nresets;    //!< resets since the last trim
+};
+
 
 /*---------------------------------------------------------------------------*/
 /* Function prototypes                                                       */
@@ -40,24 +61,34 @@ typedef struct st_trie {
 
 /* \brief Finalize node management.
  * \note
- * - trie nodes and bit vectors are cleared.
+ * - trie nodes and bit vectors are cleared, and all chunks are freed.
  * - trie_t data structure is not cleared for a later use!
  * - Call trie_delete to destroy trie_t data structure.
  */
-extern void     trie_finalize(void);
+extern void     trie_finalize(trie_mgr *m);
 
 /* \brief Setup node management. If tries are already created, they are initialized.
  * \note 
- * - Call pior to any other function calls. 
+ * - Call pior to any other function calls. m must be zero-filled before the first call.
  * - This can be also used to clear all existing tries, where length of each trie will not be changed.
+ * - Chunks allocated before are kept for reuse, except for those not used lately.
  */
-extern void     trie_initialize(void);
+extern void     trie_initialize(trie_mgr *m);
 
 /* \brief   Create an empty trie.
+ * \param   m   Manager of the trie
  * \param   n   Length of a bitvector
  * \return  Created trie.
  */
-extern trie_t*  trie_create  (int n);
+extern trie_t*  trie_create  (trie_mgr *m, int n);
+
+/* \brief Remove all nodes of a trie, whose chunks are kept by the manager for reuse.
+ */
+extern void     trie_clear(trie_t *t);
+
+/* \brief Free spare chunks of the manager until all chunks take at most limit bytes.
+ */
+extern void     trie_trim(trie_mgr *m, size_t limit);
 
 /* \brief delete a specified trie.
  * \note to finish the usage of trie completely, call trie_finalize.
@@ -7,6 +7,11 @@ extern "C" {
 
 #include <vector>
 #include <cstdlib>
+#include <limits>
+#ifdef _STATS
+#include <atomic>
+#include <iomanip>
+#endif
 
 typedef unsigned variable;  
 
@@ -67,9 +72,12 @@ typedef std::vector<literal> clause;
 
 class valuation {
 private:
+  bddctx * _ctx = nullptr;
   bdd_data _data;
   int _a[221];  
-  obdd_t* _b[221];
+  obdd_t _b[221];
+  // The don't-care positions of the current solution cube
+  int _d[221];
   unsigned _size;
 public:
   valuation(unsigned size)
@@ -77,16 +85,19 @@ public:
     _size = size;
     _data.a = _a;
     _data.b = _b;
-    reset(nullptr);
+    _data.d = _d;
+    reset(nullptr, 0);
   }
 
   
-  void reset(obdd_t * p)
+  void reset(bddctx * ctx, obdd_t p)
   {    
+    _ctx = ctx;
     for(unsigned i = 0; i <= _size; i++)
       {
 	_a[i] = 0;
-	_b[i] = nullptr;
+	_b[i] = 0;
+	_d[i] = 0;
       }
     _data.n = _size;
     _data.s = 0;
@@ -101,15 +112,18 @@ public:
   {
     if(_data.done == 0)
       {
-	decompose_bdd(&_data);
+	decompose_bdd(_ctx, &_data);
 	return _data.sol_found == 1;
       }
     else
       return false;
   }
   
+  // Don't-care variables of the solution cube are undefined
   extended_boolean variable_value(variable v) const
   {
+    if(_d[v])
+      return B_UNDEFINED;
     return _a[v] > 0 ? B_TRUE : B_FALSE;
   }
   
@@ -123,12 +137,46 @@ public:
 };
 
 
+#ifdef _STATS
+// Cache statistics of all the compilations (compile with -D_STATS)
+struct solver_stats {
+  std::atomic<unsigned long> _lookups { 0 };
+  std::atomic<unsigned long> _hits { 0 };
+  std::atomic<unsigned long> _evictions { 0 };
+  std::atomic<unsigned long> _max_bytes { 0 };
+};
+
+inline solver_stats g_solver_stats;
+
+inline
+void print_solver_stats(std::ostream & ostr)
+{
+  unsigned long lookups = g_solver_stats._lookups;
+  unsigned long hits = g_solver_stats._hits;
+  ostr << "Cache lookups: " << lookups << " (hits: " << hits;
+  if(lookups != 0)
+    ostr << ", " << std::fixed << std::setprecision(1) << 100.0 * hits / lookups << "%";
+  ostr << "; evicted levels: " << g_solver_stats._evictions
+       << "; most cache memory: " << g_solver_stats._max_bytes / 1024 << "KB)" << std::endl;
+}
+#endif
+
 class solver {
 private:
+  // Each solver has its own context, so that the solvers of
+  // different threads (or of different levels of the search) never
+  // share obdd nodes
+  bddctx * _ctx = nullptr;
   bddsolver * _s = nullptr;
   valuation _val;
   unsigned _num_of_vars;
   bool _conflict = false;
+  // The compiled obdd, and the mark of its storage, after which the
+  // nodes of conjoin_clauses() and filter_lex_leq() are obtained
+  obdd_t _base = 0;
+  obdd_t _mark = 0;
+  // The obdd whose solutions are enumerated
+  obdd_t _root = 0;
 public:
   solver(unsigned num)
     :_val(num),
@@ -158,11 +206,20 @@ public:
   {
     if(_s != nullptr)
       {
-	release_obdd_storage(0);	
+	release_obdd_storage(_ctx, 0);	
 	solver_reset(_s);
       }
     else
-      _s = solver_new();
+      {
+	_ctx = bddctx_new();
+	_s = solver_new(_ctx);
+#ifdef _BDD_CACHE_KB
+	// The budget (compile with -D_BDD_CACHE_KB=<kilobytes>) covers
+	// only the cache tries of the solver, not the obdd nodes, so
+	// it does not cap the whole memory of the process
+	solver_setcachebudget(_s, (size_t)_BDD_CACHE_KB << 10);
+#endif
+      }
     _conflict = false;
   }
   
@@ -189,6 +246,16 @@ public:
       solver_setpersistent(_s);	  	
   }
 
+  // At-most-one constraint, encoded by the binary clauses
+  void add_at_most_one(const clause & lits, bool persistent)
+  {
+    std::vector<clause> clauses;
+    for(unsigned i = 0; i < lits.size(); i++)
+      for(unsigned j = i + 1; j < lits.size(); j++)
+	clauses.push_back({ opposite_literal(lits[i]), opposite_literal(lits[j]) });
+    add_clauses(clauses, persistent);
+  }
+
   void initialize_solver()
   {
     if(solver_simplify(_s)  == -1)
@@ -196,15 +263,92 @@ public:
     else
       {
 	solver_solve(_s,0,0);
-	_val.reset(get_root(_s));
+#ifdef _STATS
+	bdd_cache_stats cs;
+	get_cache_stats(_s, &cs);
+	g_solver_stats._lookups.fetch_add(cs.lookups, std::memory_order_relaxed);
+	g_solver_stats._hits.fetch_add(cs.hits, std::memory_order_relaxed);
+	g_solver_stats._evictions.fetch_add(cs.evictions, std::memory_order_relaxed);
+	unsigned long max_bytes = g_solver_stats._max_bytes;
+	while(cs.max_bytes > max_bytes && !g_solver_stats._max_bytes.compare_exchange_weak(max_bytes, cs.max_bytes))
+	  ;
+#endif
+	_base = get_root(_s);
+	_mark = mark_obdd_storage(_ctx);
+	_root = _base;
+	_val.reset(_ctx, _root);
       }
   }
+
+  // Restricts the solutions to the ones of the compiled obdd that
+  // satisfy also the clauses and the at-most-one constraint, by
+  // conjoining them onto the obdd (which is kept, so that other
+  // clauses can be conjoined instead)
+  void conjoin_clauses(const std::vector<clause> & clauses, const clause & amo)
+  {
+    if(_conflict)
+      return;
+    
+    rewind_obdd_storage(_ctx, _mark);
+    obdd_t p = _base;
+    std::vector<int> lits;
+    for(const clause & cl : clauses)
+      if(cl.size() == 1)
+	lits.push_back(cl[0]);
+    if(!lits.empty())
+      p = conjoin_bdd(_s, p, lits.data(), lits.data() + lits.size(), lits.size(), lits.size());
+    
+    for(const clause & cl : clauses)
+      if(cl.size() > 1)
+	{
+	  lits.assign(cl.begin(), cl.end());
+	  p = conjoin_bdd(_s, p, lits.data(), lits.data() + lits.size(), 1, lits.size());
+	}
+    
+    if(!amo.empty())
+      {
+	lits.assign(amo.begin(), amo.end());
+	p = conjoin_bdd(_s, p, lits.data(), lits.data() + lits.size(), 0, 1);
+      }
+    _root = p;
+    _val.reset(_ctx, _root);
+  }
+
+  // Removes the solutions in which the values of the literals of x
+  // are lexicographically greater than the ones of y (the literals
+  // x[i] and y[i] must differ)
+  void filter_lex_leq(const std::vector<literal> & x, const std::vector<literal> & y)
+  {
+    if(_conflict || x.empty())
+      return;
+
+    std::vector<int> xl(x.begin(), x.end());
+    std::vector<int> yl(y.begin(), y.end());
+    _root = filter_lex_bdd(_s, _root, xl.data(), yl.data(), xl.size());
+    _val.reset(_ctx, _root);
+  }
+  
+  // Counts the solutions without enumerating them (false if their
+  // number does not fit into count)
+  bool count_solutions(unsigned long & count)
+  {
+    count = 0;
+    if(_conflict)
+      return true;
+
+    uint64_t hi;
+    uint64_t lo = count_bdd(_s, _root, &hi);
+    if(hi != 0 || lo > std::numeric_limits<unsigned long>::max())
+      return false;
+    count = lo;
+    return true;
+  }
   
   ~solver() {
     if(_s != nullptr)
       {
 	solver_delete(_s);
-	release_obdd_storage(1);
+	bddctx_delete(_ctx);
       }
   }
   
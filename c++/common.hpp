@@ -11,6 +11,9 @@
 #include <unordered_set>
 #include <numeric>
 #include <memory>
+#ifdef _STATS
+#include <atomic>
+#endif
 
 
 #ifdef BDD_CONVEX
@@ -285,18 +288,26 @@ std::ostream & operator << (std::ostream & ostr, const structure & str)
    automorphism of the previous structure, and with k equal to the
    index of the first point in the innermost hull (since we are
    permuting only the innermost hull). In new_perm the automorphisms
-   of the configuration are stored. */
+   of the configuration are stored. Only the values conf[0], ...,
+   conf[known - 1] are considered to be known, except the ones marked
+   in free (if given): the permutations whose comparison reaches an
+   unknown value are not extended further (so the configuration is
+   found smaller only if all of its completions are). */
 #ifdef _ORDER_TYPES
 bool search_smaller_permutation(permutation & perm,
 				unsigned k,
 				const configuration & conf,
+				unsigned known,
 				std::vector<permutation_ptr> & new_perms,
-				bool mirrored = false)
+				bool mirrored = false,
+				const std::vector<bool> * free = nullptr)
 #else
   bool search_smaller_permutation(permutation & perm,
 				  unsigned k,
 				  const configuration & conf,
-				  std::vector<permutation_ptr> & new_perms)
+				  unsigned known,
+				  std::vector<permutation_ptr> & new_perms,
+				  const std::vector<bool> * free = nullptr)
 #endif
 {
 #ifndef _PARALLEL
@@ -308,6 +319,10 @@ bool search_smaller_permutation(permutation & perm,
   
   unsigned size = perm.size();
   equals[k].clear();
+
+  // No value of the prefix determined at this point is known
+  if(k >= 2 && (unsigned)num_of_triplets(k) >= known)
+    return false;
   
   /* Checking the possible values to assign to k in order to extend
      the partial permutation perm[0],perm[1],...,perm[k-1].  */
@@ -331,6 +346,11 @@ bool search_smaller_permutation(permutation & perm,
 	      bool positive = triplet_positive(trans_tr);
 	      normalize_triplet(trans_tr);
 	      unsigned tr_pos = triplet_position(trans_tr);
+	      if(j >= known || tr_pos >= known || (free != nullptr && ((*free)[j] || (*free)[tr_pos])))
+		{
+		  rec = false;  // UNKNOWN, SKIP IT
+		  break;
+		}
 #ifdef _ORDER_TYPES
 	      bool new_conf = positive && !mirrored || !positive && mirrored ? conf[tr_pos] : !conf[tr_pos];
 #else
@@ -377,9 +397,9 @@ bool search_smaller_permutation(permutation & perm,
       std::swap(perm[equals[k][i]], perm[k]);
 
 #ifdef _ORDER_TYPES
-      if(search_smaller_permutation(perm, k + 1, conf, new_perms, mirrored))
+      if(search_smaller_permutation(perm, k + 1, conf, known, new_perms, mirrored, free))
 #else
-	if(search_smaller_permutation(perm, k + 1, conf, new_perms))
+	if(search_smaller_permutation(perm, k + 1, conf, known, new_perms, free))
 #endif
 	return true; 
 	  
@@ -390,6 +410,45 @@ bool search_smaller_permutation(permutation & perm,
 }
 
 
+// Appends to decisive the positions of the values that decide that
+// the permutation perm (found by search_smaller_permutation() called
+// for the level k) gives a smaller configuration than conf: the
+// compared values up to the first difference, and their images
+#ifdef _ORDER_TYPES
+void decisive_positions(const permutation & perm,
+			unsigned k,
+			const configuration & conf,
+			std::vector<unsigned> & decisive,
+			bool mirrored = false)
+#else
+void decisive_positions(const permutation & perm,
+			unsigned k,
+			const configuration & conf,
+			std::vector<unsigned> & decisive)
+#endif
+{
+  k = std::max(k, 2u);
+  triplet tr = triplet { 0, 1, k };
+  for(unsigned j = num_of_triplets(k); j < conf.size(); j++)
+    {
+      triplet trans_tr = triplet { perm[std::get<0>(tr)], perm[std::get<1>(tr)], perm[std::get<2>(tr)] };
+      bool positive = triplet_positive(trans_tr);
+      normalize_triplet(trans_tr);
+      unsigned tr_pos = triplet_position(trans_tr);
+#ifdef _ORDER_TYPES
+      bool new_conf = positive && !mirrored || !positive && mirrored ? conf[tr_pos] : !conf[tr_pos];
+#else
+      bool new_conf = positive ? conf[tr_pos] : !conf[tr_pos];
+#endif
+      decisive.push_back(j);
+      decisive.push_back(tr_pos);
+      if(new_conf != conf[j])
+	return;
+      next_triplet(tr);
+    }
+}
+
+
 class cyclic_store {
 private:
   std::vector<std::vector<permutation_ptr>> _cyclic_permutations;
@@ -538,6 +597,46 @@ const configuration & smallest_configuration(unsigned size)
 
 
 
+#ifdef _STATS
+// Numbers of the candidates generated by the solvers and of the
+// canonical ones among them (compile with -D_STATS)
+struct generation_stats {
+  std::atomic<unsigned long> _candidates { 0 };
+  std::atomic<unsigned long> _canonical { 0 };
+};
+
+inline generation_stats g_generation_stats;
+
+inline
+void print_generation_stats(std::ostream & ostr)
+{
+  unsigned long candidates = g_generation_stats._candidates;
+  unsigned long canonical = g_generation_stats._canonical;
+  ostr << "Candidates: " << candidates << " (canonical: " << canonical;
+  if(canonical != 0)
+    ostr << ", " << std::fixed << std::setprecision(2) << (double)candidates / canonical << " per canonical";
+  ostr << ")" << std::endl;
+}
+#endif
+
+// Checks if is_canonical() accepts every configuration of the
+// structure: the previous structure has only trivial automorphism,
+// and only one point is in the last hull
+inline
+bool all_canonical(unsigned struct_size,
+		   const std::vector<permutation_ptr> & prev_perms,
+#ifdef _ORDER_TYPES
+		   const std::vector<permutation_ptr> & m_prev_perms,
+#endif
+		   unsigned size)
+{
+#ifdef _ORDER_TYPES
+  if(m_prev_perms.size() != 0)
+    return false;
+#endif
+  return struct_size != 1 && prev_perms.size() == 1 && (*prev_perms[0]).size() == size - 1;
+}
+
 // Checks if the configuration is canonical (i.e. smallest of all in its class)
 inline
 bool is_canonical(const configuration & conf,
@@ -551,6 +650,7 @@ bool is_canonical(const configuration & conf,
 #ifdef _ORDER_TYPES
 		  , std::vector<permutation_ptr> & m_new_perms
 #endif
+		  , std::vector<unsigned> * decisive = nullptr
 		  )
 {
   // Special case: convex poligon -- only all-false configuration is
@@ -558,12 +658,19 @@ bool is_canonical(const configuration & conf,
   if(struct_size == 1)
     {
       if(conf != smallest_configuration(size))
-	return false;
+	{
+	  if(decisive != nullptr)
+	    decisive->push_back(std::find(conf.begin(), conf.end(), true) - conf.begin());
+	  return false;
+	}
       else
 	{
 	  new_perms = cyclic_permutations(size);
 #ifdef _ORDER_TYPES
 	  m_new_perms = mirrored_cyclic_permutations(size);
+#endif
+#ifdef _STATS
+	  g_generation_stats._canonical.fetch_add(1, std::memory_order_relaxed);
 #endif
 	  return true;
 	}
@@ -573,14 +680,17 @@ bool is_canonical(const configuration & conf,
   // Special case: previous structure has only trivial automorhism,
   // and only one point is in the last hull
 #ifdef _ORDER_TYPES
-  if(m_prev_perms.size() == 0 && prev_perms.size() == 1 && (*prev_perms[0]).size() == size - 1)
+  if(all_canonical(struct_size, prev_perms, m_prev_perms, size))
 #else
-    if(prev_perms.size() == 1 && (*prev_perms[0]).size() == size - 1)
+  if(all_canonical(struct_size, prev_perms, size))
 #endif
     {
       perm = *prev_perms[0];
       perm.push_back(size - 1);
       new_perms.push_back(get_perm_ptr(perm));
+#ifdef _STATS
+      g_generation_stats._canonical.fetch_add(1, std::memory_order_relaxed);
+#endif
       return true;
     }
 
@@ -593,8 +703,10 @@ bool is_canonical(const configuration & conf,
       for(unsigned t = k; t < size; t++)
 	perm.push_back(t);
       
-      if(search_smaller_permutation(perm, k, conf, new_perms))
+      if(search_smaller_permutation(perm, k, conf, conf.size(), new_perms))
 	{
+	  if(decisive != nullptr)
+	    decisive_positions(perm, k, conf, *decisive);
 	  return false;
 	}
     }
@@ -609,36 +721,380 @@ bool is_canonical(const configuration & conf,
       for(unsigned t = k; t < size; t++)
 	perm.push_back(t);
       
-      if(search_smaller_permutation(perm, k, conf, m_new_perms, true))
+      if(search_smaller_permutation(perm, k, conf, conf.size(), m_new_perms, true))
 	{
+	  if(decisive != nullptr)
+	    decisive_positions(perm, k, conf, *decisive, true);
 	  return false;
 	}
     }  
 #endif
   
+#ifdef _STATS
+  g_generation_stats._canonical.fetch_add(1, std::memory_order_relaxed);
+#endif
   return true;
 }
 
+// Checks if the configuration whose values conf[0], ...,
+// conf[known - 1] are known (except the ones marked in free, if
+// given) could still be canonical, i.e. if no automorphism of the
+// previous structure already gives a smaller prefix (the positions
+// that decide it are appended to decisive)
+inline
+bool may_be_canonical(const configuration & conf,
+		      unsigned known,
+		      unsigned struct_size,
+		      const std::vector<permutation_ptr> & prev_perms,
+#ifdef _ORDER_TYPES
+		      const std::vector<permutation_ptr> & m_prev_perms,
+#endif
+		      unsigned size,
+		      std::vector<unsigned> & decisive,
+		      const std::vector<bool> * free = nullptr)
+{
+  // Convex poligon: only the all-false configuration is canonical
+  if(struct_size == 1)
+    {
+      for(unsigned j = 0; j < known; j++)
+	if(conf[j] && (free == nullptr || !(*free)[j]))
+	  {
+	    decisive.push_back(j);
+	    return false;
+	  }
+      return true;
+    }
+
+#ifdef _ORDER_TYPES
+  if(m_prev_perms.size() == 0 && prev_perms.size() == 1 && (*prev_perms[0]).size() == size - 1)
+#else
+  if(prev_perms.size() == 1 && (*prev_perms[0]).size() == size - 1)
+#endif
+    return true;
+
+  // The automorphisms are never found for the unknown values
+  std::vector<permutation_ptr> no_perms;
+  permutation perm;
+  for(const auto & prev_perm : prev_perms)
+    {
+      perm = *prev_perm;
+
+      unsigned k = perm.size();
+      for(unsigned t = k; t < size; t++)
+	perm.push_back(t);
+      
+      if(search_smaller_permutation(perm, k, conf, known, no_perms, free))
+	{
+	  decisive_positions(perm, k, conf, decisive);
+	  return false;
+	}
+    }
+
+#ifdef _ORDER_TYPES
+  for(const auto & m_prev_perm : m_prev_perms)
+    {
+      perm = *m_prev_perm;
+
+      unsigned k = perm.size();
+      for(unsigned t = k; t < size; t++)
+	perm.push_back(t);
+      
+      if(search_smaller_permutation(perm, k, conf, known, no_perms, true, free))
+	{
+	  decisive_positions(perm, k, conf, decisive, true);
+	  return false;
+	}
+    }  
+#endif
+  
+  return true;
+}
 
 
 class configuration_generator {
 private:
   unsigned _size;
-  std::vector<clause> _axiom_clauses;
-  std::vector<clause> _prev_conf_clauses;
-  std::vector<clause> _prev_struct_clauses;
-  std::vector<clause> _new_struct_clauses;
+  // The clause sets are not changed once they are made (new ones
+  // replace them), so the snapshots share them with the generator
+  using clauses_ptr = std::shared_ptr<const std::vector<clause>>;
+  clauses_ptr _axiom_clauses;
+  std::vector<clauses_ptr> _prev_conf_clauses;
+  clauses_ptr _prev_struct_clauses;
+  clauses_ptr _new_struct_clauses;
+  clause _new_struct_amo;
+  configuration _loaded_conf;
   solver _s;
   bool _first_conf;
+  // The solution cube returned last by the solver: its don't-care
+  // positions (undefined in the valuation, and marked in _cube_mask),
+  // whose values are enumerated by the generator, and the nogoods
+  // added for its configurations so far, which block the remaining
+  // ones
+  std::vector<unsigned> _cube_free;
+  std::vector<std::vector<std::pair<unsigned, bool>>> _cube_nogoods;
+  std::vector<bool> _cube_mask;
+#ifdef BDD_CONVEX
+  // Whether the diagram of the loaded configuration (without the
+  // clauses of the structure) is compiled
+  bool _conf_compiled = false;
+#endif
+
+  // The automorphisms of the previous structure (see set_structure()),
+  // used by the canonicity checks of the cubes and of the prefixes
+  std::vector<unsigned> _decisive;
+  unsigned _check_struct_size = 0;
+  const std::vector<permutation_ptr> * _check_perms = nullptr;
+#ifdef _ORDER_TYPES
+  const std::vector<permutation_ptr> * _check_m_perms = nullptr;
+#endif
+
+#if !defined PICO_CONVEX && !defined BDD_CONVEX
+  // The canonicity check of the partial assignments, made by the
+  // solver for the prefixes of the new triplets
+  configuration _partial_conf;
+
+  void set_prefix_check()
+  {
+    _s.set_prefix_check(num_of_triplets(_size - 1), [this] (const valuation & val, unsigned p) -> bool
+			{
+			  // Complete models are checked by is_canonical()
+			  if(_check_perms == nullptr || p == _partial_conf.size())
+			    return true;
+			  for(unsigned v = num_of_triplets(_size - 1); v < p; v++)
+			    _partial_conf[v] = val.variable_value(v) == B_TRUE;
+			  _decisive.clear();
+#ifdef _ORDER_TYPES
+			  if(may_be_canonical(_partial_conf, p, _check_struct_size, *_check_perms, *_check_m_perms, _size, _decisive))
+#else
+			  if(may_be_canonical(_partial_conf, p, _check_struct_size, *_check_perms, _size, _decisive))
+#endif
+			    return true;
+			  add_nogood(_partial_conf, _decisive);
+			  return false;
+			});
+  }
+#endif
+
+  // The clauses of the old configuration are grouped by points (the
+  // group of the point k fixes the triplets whose greatest point is
+  // k, for k = 2,...,_size - 2), and each group is added in its own
+  // clause context, followed by the contexts of the previous and the
+  // new structure. Thus, when the next configuration is set, only the
+  // contexts of the groups that differ are replaced.
+  unsigned num_of_conf_groups() const
+  {
+    return _size - 3;
+  }
+
+  unsigned structure_context() const
+  {
+    return num_of_conf_groups() + 1;
+  }
+
+#if defined _LEX_LEADER || defined _LEX_FILTER
+  // The automorphism perm of the previous structure, extended with
+  // the identity on the remaining points, is one of the permutations
+  // tried by is_canonical(), so the new triplets of a canonical
+  // configuration are lexicographically smaller than or equal to
+  // their images, if the old ones are equal. Sets the pairs (x, y)
+  // of the new triplets x and the literals y whose values are the
+  // images, in the order of the comparison, omitting the ones with
+  // y == x, and ending at the first one that is decided by itself (y
+  // == not x). Returns false if the old triplets differ from their
+  // images.
+  bool lex_leader_pairs(const configuration & old_conf, const permutation & perm, bool mirrored,
+			std::vector< std::pair<literal, literal> > & pairs) const
+  {
+    auto point = [&perm] (unsigned p) -> unsigned
+		 {
+		   return p < perm.size() ? perm[p] : p;
+		 };
+    // The literal whose value is the value of the triplet tr in
+    // the permuted configuration
+    auto image = [&point, mirrored] (const triplet & tr) -> literal
+		 {
+		   triplet trans_tr = triplet { point(std::get<0>(tr)), point(std::get<1>(tr)), point(std::get<2>(tr)) };
+		   bool positive = triplet_positive(trans_tr);
+		   normalize_triplet(trans_tr);
+		   return lit_from_var(triplet_position(trans_tr), positive != mirrored ? P_POSITIVE : P_NEGATIVE);
+		 };
+    
+    pairs.clear();
+    // The old triplets are fixed, so the comparison may be decided
+    // before the new ones
+    triplet tr = triplet { 0, 1, 2 };
+    for(unsigned j = 0; j < old_conf.size(); j++, next_triplet(tr))
+      {
+	literal y = image(tr);
+	bool y_value = is_positive(y) ? old_conf[var_from_lit(y)] : !old_conf[var_from_lit(y)];
+	if(y_value != old_conf[j])
+	  return false;
+      }
+
+    for(unsigned j = old_conf.size(), limit = num_of_triplets(_size); j < limit; j++, next_triplet(tr))
+      {
+	literal x = lit_from_var(j, P_POSITIVE);
+	literal y = image(tr);
+	if(y == x)
+	  continue;
+	pairs.push_back({ x, y });
+	// The values x and not x always differ, so the comparison
+	// is decided here
+	if(y == opposite_literal(x))
+	  break;
+      }
+    return true;
+  }
+#endif
+
+#ifdef _LEX_LEADER
+  // Number of the positions (with non-trivial comparisons) that are
+  // constrained by the lex-leader clauses of each automorphism
+  static const unsigned lex_leader_depth = 4;
+  
+  // Lex-leader symmetry breaking (compile with -D_LEX_LEADER): the
+  // comparison of lex_leader_pairs() is encoded by clauses (there
+  // are no auxiliary variables), which are added only for the first
+  // positions of the comparison: the clause for a position contains
+  // one of two literals for each preceding position (that differs
+  // first). This is experimental: no backend was measurably faster
+  // with it, since the prefix check and the nogoods already reject
+  // most of the candidates that these clauses would remove.
+  void add_lex_leader_clauses(const configuration & old_conf, const permutation & perm, bool mirrored,
+			      std::vector<clause> & new_struct_clauses) const
+  {
+    std::vector< std::pair<literal, literal> > pairs;
+    if(!lex_leader_pairs(old_conf, perm, mirrored, pairs))
+      return;
+
+    // The pairs (x, y) that precede the current position
+    std::vector< std::pair<literal, literal> > prec;
+    for(unsigned k = 0; k < pairs.size() && prec.size() < lex_leader_depth; k++)
+      {
+	literal x = pairs[k].first;
+	literal y = pairs[k].second;
+	// Equal if the preceding values are equal (the same
+	// variables, and the same polarities up to the negation)
+	if(std::any_of(prec.begin(), prec.end(), [x, y] (const std::pair<literal, literal> & pr)
+		       {
+			 return ((pr.first ^ pr.second) & 1) == ((x ^ y) & 1) &&
+			   ((var_from_lit(pr.first) == var_from_lit(x) && var_from_lit(pr.second) == var_from_lit(y)) ||
+			    (var_from_lit(pr.first) == var_from_lit(y) && var_from_lit(pr.second) == var_from_lit(x)));
+		       }))
+	  continue;
+
+	// x <= y, unless some preceding x is smaller than its y
+	for(unsigned mask = 0; mask < (1u << prec.size()); mask++)
+	  {
+	    clause cl;
+	    for(unsigned i = 0; i < prec.size(); i++)
+	      cl.push_back(mask & (1u << i) ? prec[i].second : opposite_literal(prec[i].first));
+	    cl.push_back(opposite_literal(x));
+	    if(y != opposite_literal(x))
+	      cl.push_back(y);
+	    new_struct_clauses.push_back(cl);
+	  }
+	if(y == opposite_literal(x))
+	  return;
+	prec.push_back({ x, y });
+      }
+  }
+#endif
+
+#if defined _LEX_FILTER && defined BDD_CONVEX
+  // Symbolic lex-leader filtering (compile with -D_LEX_FILTER, BDD
+  // solver only): the solutions whose new triplets are greater than
+  // their images (see lex_leader_pairs()) are removed from the
+  // compiled diagram, so that they are not checked by is_canonical()
+  void filter_lex_leader(const configuration & old_conf, const permutation & perm, bool mirrored)
+  {
+    std::vector< std::pair<literal, literal> > pairs;
+    if(!lex_leader_pairs(old_conf, perm, mirrored, pairs))
+      return;
+
+    std::vector<literal> x, y;
+    for(const auto & pr : pairs)
+      {
+	x.push_back(pr.first);
+	y.push_back(pr.second);
+      }
+    _s.filter_lex_leq(x, y);
+  }
+#endif
 public:
+#if !defined PICO_CONVEX && !defined BDD_CONVEX
+  // Creates a snapshot of the loaded generator (the solver state
+  // included), so that the remaining work can be continued
+  // independently (e.g. in another thread). The clause sets are
+  // shared, only the solver state is copied. The snapshot does not
+  // continue the current cube (it belongs to the branch that stays
+  // with cg), so it starts with an empty one.
+  configuration_generator(const configuration_generator & cg)
+    :_size(cg._size),
+     _axiom_clauses(cg._axiom_clauses),
+     _prev_conf_clauses(cg._prev_conf_clauses),
+     _prev_struct_clauses(cg._prev_struct_clauses),
+     _new_struct_clauses(cg._new_struct_clauses),
+     _new_struct_amo(cg._new_struct_amo),
+     _loaded_conf(cg._loaded_conf),
+     _s(cg._s, solver::snapshot_tag()),
+     _first_conf(cg._first_conf),
+     _cube_mask(cg._cube_mask.size(), false),
+     _check_struct_size(cg._check_struct_size),
+     _check_perms(cg._check_perms),
+#ifdef _ORDER_TYPES
+     _check_m_perms(cg._check_m_perms),
+#endif
+     _partial_conf(cg._partial_conf)
+  {
+    set_prefix_check();
+  }
+#endif
+
+  // Splits the remaining search space of the current structure (on
+  // a guiding path): the returned snapshot continues with the
+  // unexplored branch of the first decision, which is removed from
+  // this generator. Returns nullptr if the search cannot be split
+  // (the picosat and BDD solvers cannot be split, so their parallel
+  // builds distribute only the configurations being augmented).
+  std::shared_ptr<configuration_generator> split()
+  {
+#if !defined PICO_CONVEX && !defined BDD_CONVEX
+    if(!_s.can_split())
+      return nullptr;
+
+    std::shared_ptr<configuration_generator> cg = std::make_shared<configuration_generator>(*this);
+    cg->_s.take_unexplored_branch();
+    _s.keep_current_branch();
+    return cg;
+#else
+    return nullptr;
+#endif
+  }
+  
+
   configuration_generator(unsigned size)
     :_size(size),
+     _axiom_clauses(std::make_shared<const std::vector<clause>>()),
+     _prev_struct_clauses(_axiom_clauses),
+     _new_struct_clauses(_axiom_clauses),
      _s(num_of_triplets(size)),
      _first_conf(true)
   {
     
     if(size < 4)
       return;
+
+    _cube_mask.resize(num_of_triplets(size), false);
+#if !defined PICO_CONVEX && !defined BDD_CONVEX
+    _partial_conf.resize(num_of_triplets(size));
+    set_prefix_check();
+    _s.set_cube_mode(true);
+#elif defined PICO_CONVEX
+    _s.set_projection(num_of_triplets(size - 1));
+#endif
+    
+    std::vector<clause> axiom_clauses;
     
     // Axiom 4
     triplet qr = triplet { 0, 1, 2 };
@@ -653,12 +1109,12 @@ public:
 	unsigned pqr_pos = triplet_position(triplet { std::get<0>(qr), std::get<1>(qr), std::get<2>(qr) });
 
 	
-	_axiom_clauses.push_back({ lit_from_var(qrt_pos, P_NEGATIVE),
+	axiom_clauses.push_back({ lit_from_var(qrt_pos, P_NEGATIVE),
 				   lit_from_var(prt_pos, P_POSITIVE),
 				   lit_from_var(pqt_pos, P_NEGATIVE),
 				   lit_from_var(pqr_pos, P_POSITIVE) });
 
-	_axiom_clauses.push_back({ lit_from_var(qrt_pos, P_POSITIVE),
+	axiom_clauses.push_back({ lit_from_var(qrt_pos, P_POSITIVE),
 				   lit_from_var(prt_pos, P_NEGATIVE),
 				   lit_from_var(pqt_pos, P_POSITIVE),
 				   lit_from_var(pqr_pos, P_NEGATIVE) });
@@ -667,7 +1123,10 @@ public:
       }
     
     if(size < 5)
-      return;
+      {
+	_axiom_clauses = std::make_shared<const std::vector<clause>>(std::move(axiom_clauses));
+	return;
+      }
     
     // Axiom 5
     triplet tr = triplet { 0, 1, 2 };
@@ -714,14 +1173,14 @@ public:
 		unsigned prt_pos = triplet_position(prt);
 
 
-		_axiom_clauses.push_back( { lit_from_var(pts_pos, pts_pol ? P_NEGATIVE : P_POSITIVE),
+		axiom_clauses.push_back( { lit_from_var(pts_pos, pts_pol ? P_NEGATIVE : P_POSITIVE),
 					    lit_from_var(qts_pos, qts_pol ? P_NEGATIVE : P_POSITIVE),
 					    lit_from_var(rts_pos, rts_pol ? P_NEGATIVE : P_POSITIVE),
 					    lit_from_var(pqt_pos, pqt_pol ? P_NEGATIVE : P_POSITIVE),
 					    lit_from_var(qrt_pos, qrt_pol ? P_NEGATIVE : P_POSITIVE),
 					    lit_from_var(prt_pos, prt_pol ? P_POSITIVE : P_NEGATIVE) });
 		
-		_axiom_clauses.push_back( { lit_from_var(pts_pos, pts_pol ? P_NEGATIVE : P_POSITIVE),
+		axiom_clauses.push_back( { lit_from_var(pts_pos, pts_pol ? P_NEGATIVE : P_POSITIVE),
 					    lit_from_var(qts_pos, qts_pol ? P_NEGATIVE : P_POSITIVE),
 					    lit_from_var(rts_pos, rts_pol ? P_NEGATIVE : P_POSITIVE),
 					    lit_from_var(pqt_pos, pqt_pol ? P_POSITIVE : P_NEGATIVE),
@@ -732,26 +1191,54 @@ public:
 	
 	next_triplet(tr);
       }
+    _axiom_clauses = std::make_shared<const std::vector<clause>>(std::move(axiom_clauses));
 #ifndef BDD_CONVEX 
-    _s.add_clauses(_axiom_clauses);
+    _s.add_clauses(*_axiom_clauses);
+#endif
+#if !defined PICO_CONVEX && !defined BDD_CONVEX
+    _s.set_watch_lists();
 #endif
   }
   
   void set_configuration(const configuration & old_conf, const structure & prev_struct)
   {
     //    std::cout << "ENTER SET_CONFIGURATION" << std::endl;
-#ifndef BDD_CONVEX
-    _s.restore_clause_context(0);    
-#endif
-    _prev_conf_clauses.clear();
-    _prev_struct_clauses.clear();
+    unsigned num_of_groups = num_of_conf_groups();
+    
+    // The first group that differs from the loaded configuration
+    unsigned first_changed = num_of_groups;
+    if(_loaded_conf.size() != old_conf.size())
+      {
+	first_changed = 0;
+	_prev_conf_clauses.resize(num_of_groups);
+      }
+    else
+      {
+	unsigned v = std::mismatch(old_conf.begin(), old_conf.end(), _loaded_conf.begin()).first - old_conf.begin();
+	if(v < old_conf.size())
+	  {
+	    first_changed = 0;
+	    while(num_of_triplets(first_changed + 3) <= (int)v)
+	      first_changed++;
+	  }
+      }
     
     // Unit clauses that fix old configuration that is being augmented
-    for(unsigned v = 0; v < old_conf.size(); v++)
+    for(unsigned g = first_changed; g < num_of_groups; g++)
       {
-	_prev_conf_clauses.push_back({ lit_from_var(v, old_conf[v] ? P_POSITIVE : P_NEGATIVE) });
+	std::vector<clause> group_clauses;
+	for(unsigned v = num_of_triplets(g + 2), limit = num_of_triplets(g + 3); v < limit; v++)
+	  {
+	    group_clauses.push_back({ lit_from_var(v, old_conf[v] ? P_POSITIVE : P_NEGATIVE) });
+	  }
+	_prev_conf_clauses[g] = std::make_shared<const std::vector<clause>>(std::move(group_clauses));
       }
-
+    _loaded_conf = old_conf;
+#ifdef BDD_CONVEX
+    _conf_compiled = false;
+#endif
+    
+    std::vector<clause> prev_struct_clauses;
     unsigned s = 0;  // Start point of the current hull
 
     for(unsigned i = 0, limit = prev_struct.size() - 1; i < limit; i++)
@@ -777,24 +1264,62 @@ public:
 	    bool tr_pol = triplet_positive(tr);
 	    normalize_triplet(tr);
 	    unsigned tr_pos = triplet_position(tr);
-	    _prev_struct_clauses.push_back( { lit_from_var(tr_pos, tr_pol ? P_POSITIVE : P_NEGATIVE) });
+	    prev_struct_clauses.push_back( { lit_from_var(tr_pos, tr_pol ? P_POSITIVE : P_NEGATIVE) });
 	  }	
 	s += hull.size();
       }
+
+    if(first_changed == num_of_groups && prev_struct_clauses == *_prev_struct_clauses)
+      first_changed = structure_context();
+    else
+      _prev_struct_clauses = std::make_shared<const std::vector<clause>>(std::move(prev_struct_clauses));
+    
 #ifndef BDD_CONVEX
-    _s.add_clause_context();
-    _s.add_clauses(_prev_conf_clauses);
-    _s.add_clauses(_prev_struct_clauses);
+    _s.restore_clause_context(first_changed);
+    for(unsigned g = first_changed; g <= num_of_groups; g++)
+      {
+	_s.add_clause_context();
+	_s.add_clauses(g < num_of_groups ? *_prev_conf_clauses[g] : *_prev_struct_clauses);
+#if !defined PICO_CONVEX
+	_s.set_last_context();
+#endif
+      }
+#if !defined PICO_CONVEX
+    if(first_changed <= num_of_groups)
+      _s.simplify_clauses();
+#endif
 #endif
   }
 
-  void set_structure(const configuration & old_conf, const structure & str)
+  // The automorphisms are the ones that are passed to is_canonical()
+  // for the structure str. The solver rejects the partial
+  // assignments of the new triplets for which is_canonical() would
+  // reject all the completions (so the automorphisms must outlive
+  // the generation).
+#ifdef _ORDER_TYPES
+  void set_structure(const configuration & old_conf, const structure & str,
+		     const std::vector<permutation_ptr> & prev_perms,
+		     const std::vector<permutation_ptr> & m_prev_perms)
+#else
+  void set_structure(const configuration & old_conf, const structure & str,
+		     const std::vector<permutation_ptr> & prev_perms)
+#endif
   {
     //    std::cout << "ENTER SET_STRUCTURE: " << old_conf << ", " << str << " (" << _size << ")" << std::endl;
+    clear_cube();
 #ifndef BDD_CONVEX
-    _s.restore_clause_context(1);
+    _s.restore_clause_context(structure_context());
+#endif
+    std::vector<clause> new_struct_clauses;
+    _new_struct_amo.clear();
+#if !defined PICO_CONVEX && !defined BDD_CONVEX
+    std::copy(old_conf.begin(), old_conf.end(), _partial_conf.begin());
+#endif
+    _check_struct_size = str.size();
+    _check_perms = &prev_perms;
+#ifdef _ORDER_TYPES
+    _check_m_perms = &m_prev_perms;
 #endif
-    _new_struct_clauses.clear();
     
     unsigned s;
     if(str.back() == 1)      
@@ -803,6 +1328,9 @@ public:
       s = _size - str.back();
 
     unsigned hull_size = _size - s - 1;
+    // The literals of the edges of the innermost hull that see the
+    // new point from the outside
+    clause outside_lits;
     
     if(hull_size >= 3)
       {	
@@ -831,7 +1359,8 @@ public:
 		bool tr_pol = triplet_positive(tr);
 		normalize_triplet(tr);
 		unsigned tr_pos = triplet_position(tr);
-		_new_struct_clauses.push_back( { lit_from_var(tr_pos, tr_pol ? P_POSITIVE : P_NEGATIVE) });
+		new_struct_clauses.push_back( { lit_from_var(tr_pos, tr_pol ? P_POSITIVE : P_NEGATIVE) });
+		outside_lits.push_back(lit_from_var(tr_pos, tr_pol ? P_NEGATIVE : P_POSITIVE));
 	      }	
 	  }
 	else
@@ -845,53 +1374,239 @@ public:
 		unsigned tr_pos = triplet_position(tr);
 		cl.push_back(lit_from_var(tr_pos, tr_pol ? P_NEGATIVE : P_POSITIVE));		
 	      }
-	    _new_struct_clauses.push_back(cl);
-	    for(unsigned j1 = 0; j1 < cl.size(); j1++)
-	      for(unsigned j2 = j1 + 1; j2 < cl.size(); j2++)
-		{
-		  _new_struct_clauses.push_back({ opposite_literal(cl[j1]), opposite_literal(cl[j2]) });
-		}
+	    // Exactly one edge of the hull sees the new point from
+	    // the outside
+	    new_struct_clauses.push_back(cl);
+	    _new_struct_amo = cl;
+	    outside_lits = cl;
 	  }
       }
+
+#ifdef _LEX_LEADER
+    if(str.size() > 1)
+      {
+	for(const auto & perm : prev_perms)
+	  add_lex_leader_clauses(old_conf, *perm, false, new_struct_clauses);
+#ifdef _ORDER_TYPES
+	for(const auto & perm : m_prev_perms)
+	  add_lex_leader_clauses(old_conf, *perm, true, new_struct_clauses);
+#endif
+      }
+#endif
+    _new_struct_clauses = std::make_shared<const std::vector<clause>>(std::move(new_struct_clauses));
     _first_conf = true;
     
 #ifndef BDD_CONVEX
     _s.add_clause_context();
-    _s.add_clauses(_new_struct_clauses);
+    _s.add_clauses(*_new_struct_clauses);
+    if(!_new_struct_amo.empty())
+      _s.add_at_most_one(_new_struct_amo);
 #else
-    if(!_s.solver_created())
+    // If the configuration has two augmented structures, its diagram
+    // is compiled only for the first one, and the clauses of each
+    // structure are conjoined onto it. Both structures allow at most
+    // one edge of the innermost hull to see the new point from the
+    // outside, so this is compiled into the diagram.
+    unsigned prev_hull_size = str.back() == 1 ? str[str.size() - 2] : str.back() - 1;
+    bool conjoin = prev_hull_size >= 3;
+    if(!conjoin || !_conf_compiled)
+      {
+	if(!_s.solver_created())
+	  {
+	    _s.reset_solver();
+	    _s.add_clauses(*_axiom_clauses, true);
+	  }
+	else
+	  _s.reset_solver();
+	for(unsigned g = 0; g < _prev_conf_clauses.size(); g++)
+	  _s.add_clauses(*_prev_conf_clauses[g], false);
+	_s.add_clauses(*_prev_struct_clauses, false);
+	if(!conjoin)
+	  {
+	    _s.add_clauses(*_new_struct_clauses, false);
+	    if(!_new_struct_amo.empty())
+	      _s.add_at_most_one(_new_struct_amo, false);
+	  }
+	else
+	  _s.add_at_most_one(outside_lits, false);
+	_s.initialize_solver();
+	_conf_compiled = conjoin;
+      }
+    if(conjoin)
+      _s.conjoin_clauses(*_new_struct_clauses, clause());
+#ifdef _LEX_FILTER
+    if(str.size() > 1)
       {
-	_s.reset_solver();
-	_s.add_clauses(_axiom_clauses, true);
+	for(const auto & perm : prev_perms)
+	  filter_lex_leader(old_conf, *perm, false);
+#ifdef _ORDER_TYPES
+	for(const auto & perm : m_prev_perms)
+	  filter_lex_leader(old_conf, *perm, true);
+#endif
       }
-    else
-      _s.reset_solver();
-    _s.add_clauses(_prev_conf_clauses, false);
-    _s.add_clauses(_prev_struct_clauses, false);
-    _s.add_clauses(_new_struct_clauses, false);
-    _s.initialize_solver();
+#endif
 #endif
 
 #if !defined PICO_CONVEX && !defined BDD_CONVEX
-    _s.initialize_solver();
-    _s.set_units();
-    _s.set_watch_lists();
-    _s.simplify_clauses();
+    _s.set_last_context();
 #endif
   }
   
-  bool generate_next_configuration(configuration & conf)
+  // Blocks the values of the new triplets at the given positions of
+  // conf (the positions that decide that conf is not canonical, see
+  // is_canonical()) for the rest of the current structure
+  void add_nogood(const configuration & conf, const std::vector<unsigned> & positions)
   {
-    if(!_s.solve())
+    // The rest of the current cube is skipped if the nogood does not
+    // depend on its don't-cares
+    bool on_free = false;
+    if(!_cube_free.empty())
+      {
+	std::vector<std::pair<unsigned, bool>> ng;
+	for(unsigned v : positions)
+	  {
+	    ng.push_back({ v, conf[v] });
+	    if(_cube_mask[v])
+	      on_free = true;
+	  }
+	if(on_free)
+	  _cube_nogoods.push_back(std::move(ng));
+	else
+	  clear_cube();
+      }
+#if !defined PICO_CONVEX && !defined BDD_CONVEX
+    // The dpll solver takes only the nogoods that are false in its
+    // valuation
+    if(on_free)
+      return;
+#endif
+#ifndef BDD_CONVEX
+    unsigned first = num_of_triplets(_size - 1);
+    clause cl;
+    for(unsigned v : positions)
+      if(v >= first)
+	cl.push_back(lit_from_var(v, conf[v] ? P_NEGATIVE : P_POSITIVE));
+    std::sort(cl.begin(), cl.end());
+    cl.erase(std::unique(cl.begin(), cl.end()), cl.end());
+    if(!cl.empty())
+      _s.add_nogood(cl);
+#endif
+  }
+  
+#ifdef BDD_CONVEX
+  // Counts the configurations of the current structure without
+  // generating them (false if their number does not fit into count)
+  bool count_configurations(unsigned long & count)
+  {
+    if(!_s.count_solutions(count))
       return false;
-    
-    unsigned conf_size = conf.size();
-    for(unsigned v = _first_conf ? 0 : num_of_triplets(_size - 1) ; v < conf_size; v++)
-      {	
-	conf[v] = _s.val().variable_value(v) == B_TRUE ? true : false;
+#ifdef _STATS
+    g_generation_stats._candidates.fetch_add(count, std::memory_order_relaxed);
+#endif
+    return true;
+  }
+#endif
+  
+  void clear_cube()
+  {
+    for(unsigned v : _cube_free)
+      _cube_mask[v] = false;
+    _cube_free.clear();
+    _cube_nogoods.clear();
+    assert(std::find(_cube_mask.begin(), _cube_mask.end(), true) == _cube_mask.end());
+  }
+  
+  // Sets conf to the next configuration of the current cube (in the
+  // lexicographic order of its don't-cares, which is the order of the
+  // dpll solver, but not necessarily of the other ones) that is not
+  // blocked by its nogoods
+  bool next_cube_configuration(configuration & conf)
+  {
+    while(true)
+      {
+	unsigned i = _cube_free.size();
+	while(i > 0 && conf[_cube_free[i - 1]])
+	  conf[_cube_free[--i]] = false;
+	if(i == 0)
+	  return false;
+	conf[_cube_free[i - 1]] = true;
+
+	if(std::none_of(_cube_nogoods.begin(), _cube_nogoods.end(), [&conf] (const auto & ng)
+			{
+			  return std::all_of(ng.begin(), ng.end(), [&conf] (const auto & p)
+					     {
+					       return conf[p.first] == p.second;
+					     });
+			}))
+	  return true;
       }
+  }
+  
+#if !defined PICO_CONVEX && !defined BDD_CONVEX
+  // The prefix check of the dpll solver already rejects the cubes
+  // whose values before the first don't-care can not be canonical
+  // (and the later fixed values rarely decide it)
+  bool cube_may_be_canonical(const configuration &)
+  {
+    return true;
+  }
+#else
+  // Checks the fixed values of the current cube (in conf) once for
+  // all of its configurations, and adds the nogood if none of them
+  // is canonical (a single configuration is left to is_canonical())
+  bool cube_may_be_canonical(const configuration & conf)
+  {
+    if(_cube_free.empty() || _check_perms == nullptr)
+      return true;
+
+    _decisive.clear();
+#ifdef _ORDER_TYPES
+    if(may_be_canonical(conf, conf.size(), _check_struct_size, *_check_perms, *_check_m_perms, _size, _decisive, &_cube_mask))
+#else
+    if(may_be_canonical(conf, conf.size(), _check_struct_size, *_check_perms, _size, _decisive, &_cube_mask))
+#endif
+      return true;
+
+    clear_cube();
+    add_nogood(conf, _decisive);
+    return false;
+  }
+#endif
+  
+  bool generate_next_configuration(configuration & conf)
+  {
+    if(_cube_free.empty() || !next_cube_configuration(conf))
+      {
+	// The cubes whose configurations are all rejected by the
+	// canonicity check of their fixed values are skipped
+	do
+	  {
+	    clear_cube();
+	    if(!_s.solve())
+	      return false;
     
-    _first_conf = false;
+	    // The old triplets are the ones of the loaded configuration
+	    if(_first_conf)
+	      std::copy(_loaded_conf.begin(), _loaded_conf.end(), conf.begin());
+	    _first_conf = false;
+    
+	    unsigned conf_size = conf.size();
+	    for(unsigned v = num_of_triplets(_size - 1); v < conf_size; v++)
+	      {
+		extended_boolean value = _s.val().variable_value(v);
+		if(value == B_UNDEFINED)
+		  {
+		    _cube_free.push_back(v);
+		    _cube_mask[v] = true;
+		  }
+		conf[v] = value == B_TRUE ? true : false;
+	      }
+	  }
+	while(!cube_may_be_canonical(conf));
+      }
+#ifdef _STATS
+    g_generation_stats._candidates.fetch_add(1, std::memory_order_relaxed);
+#endif
     return true;
   }
 };
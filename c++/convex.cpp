@@ -49,6 +49,7 @@ void enumerate_configurations(unsigned limit_size)
 #ifdef _ORDER_TYPES
   std::vector<permutation_ptr> m_new_perms;
 #endif
+  std::vector<unsigned> decisive;
   // For n=3, we have only one structure [3] (with index 0 in the
   // structs vector), and only one configuration "-" of that structure
   // The automorphisms of this configuration are all cyclic
@@ -148,7 +149,6 @@ void enumerate_configurations(unsigned limit_size)
 	      const structure & str = new_structs[s_index]._struct;
 
 	      //std::cout << "Struct: " << str << std::endl;
-	      conf_gen.set_structure(prev_config, str);	      
 
 	      // If the innermost hull contains only the new
 	      // point, then we should consider only the
@@ -159,15 +159,43 @@ void enumerate_configurations(unsigned limit_size)
 	      const std::vector<permutation_ptr> & pr_perms = str.back() == 1 ? prev_perms : prev_perms_p;
 #ifdef _ORDER_TYPES
 	      const std::vector<permutation_ptr> & m_pr_perms = str.back() == 1 ? m_prev_perms : m_prev_perms_p;
+#endif
+#ifdef _ORDER_TYPES
+	      conf_gen.set_structure(prev_config, str, pr_perms, m_pr_perms);
+#else
+	      conf_gen.set_structure(prev_config, str, pr_perms);
+#endif
+
+#if defined BDD_CONVEX && !defined PRINT
+	      // At the last level, the configurations are only
+	      // counted, so if all of them are canonical, the count
+	      // is taken from the solver (none of them is achiral)
+#ifdef _ORDER_TYPES
+	      if(size == limit_size && all_canonical(str.size(), pr_perms, m_pr_perms, size))
+#else
+	      if(size == limit_size && all_canonical(str.size(), pr_perms, size))
+#endif
+		{
+		  unsigned long count;
+		  if(conf_gen.count_configurations(count))
+		    {
+#ifdef _STATS
+		      g_generation_stats._canonical.fetch_add(count, std::memory_order_relaxed);
+#endif
+		      count_configs += count;
+		      continue;
+		    }
+		}
 #endif
 	      while(conf_gen.generate_next_configuration(new_config))
 		{
 		  new_perms.clear();
+		  decisive.clear();
 #ifdef _ORDER_TYPES
 		  m_new_perms.clear();
-		  if(is_canonical(new_config, str.size(), pr_perms, m_pr_perms, size, new_perms, m_new_perms))
+		  if(is_canonical(new_config, str.size(), pr_perms, m_pr_perms, size, new_perms, m_new_perms, &decisive))
 #else
-		    if(is_canonical(new_config, str.size(), pr_perms, size, new_perms))
+		    if(is_canonical(new_config, str.size(), pr_perms, size, new_perms, &decisive))
 #endif
 		    {
 		      //	      std::cout << "CANONICAL: " << new_config << std::endl;
@@ -199,6 +227,8 @@ void enumerate_configurations(unsigned limit_size)
 #endif
 			}
 		    }
+		  else
+		    conf_gen.add_nogood(new_config, decisive);
 		}	      
 	    }
 
@@ -252,6 +282,12 @@ int main(int argc, char ** argv)
   smallest_configurations::init_instance(max_size);
   
   enumerate_configurations(max_size);
+#ifdef _STATS
+  print_generation_stats(std::cout);
+#ifndef PICO_CONVEX
+  print_solver_stats(std::cout);
+#endif
+#endif
 
   smallest_configurations::delete_instance();
   cyclic_store::delete_instance();
@@ -70,6 +70,107 @@ using ret_type = unsigned long;
 #endif
 
 
+#ifdef _PARALLEL
+// Number of threads and the number of generators that are currently
+// running (or are spawned and wait to be run)
+unsigned num_of_threads_used;
+std::atomic<unsigned> busy_generators(0);
+
+// A generator is split only after it has generated this many
+// configurations since it was started or last split (so that the
+// snapshots are made only for the large searches)
+const unsigned split_interval = 64;
+
+// Generates the canonical configurations from the loaded generator
+// and adds them to new_configs. While some of the threads are idle,
+// the remaining search space of the generator is split, and its
+// unexplored part is handed to another task. The caller must
+// increment busy_generators before the call.
+#ifdef _ORDER_TYPES
+void generate_configurations(configuration_generator & conf_gen, configuration new_config, const structure & str,
+			     const std::vector<permutation_ptr> & pr_perms, const std::vector<permutation_ptr> & m_pr_perms,
+			     unsigned size, unsigned limit_size,
+			     std::vector<conf_data_dfs> & new_configs, ret_type & count_configs, tbb::spin_mutex & mutex)
+#else
+void generate_configurations(configuration_generator & conf_gen, configuration new_config, const structure & str,
+			     const std::vector<permutation_ptr> & pr_perms,
+			     unsigned size, unsigned limit_size,
+			     std::vector<conf_data_dfs> & new_configs, ret_type & count_configs, tbb::spin_mutex & mutex)
+#endif
+{
+  std::vector<conf_data_dfs> configs;
+  ret_type count = 0;
+  std::vector<permutation_ptr> new_perms;
+#ifdef _ORDER_TYPES
+  std::vector<permutation_ptr> m_new_perms;
+#endif
+  std::vector<unsigned> decisive;
+
+  // The thread is isolated while it waits for the split tasks, so
+  // that it cannot take a task that uses its thread-local generators
+  tbb::this_task_arena::isolate([&] ()
+    {
+      tbb::task_group tg;
+      unsigned since_split = 0;
+      
+      while(conf_gen.generate_next_configuration(new_config))
+	{
+	  if(++since_split >= split_interval && busy_generators < num_of_threads_used)
+	    {
+	      since_split = 0;
+	      std::shared_ptr<configuration_generator> split_gen = conf_gen.split();
+	      if(split_gen)
+		{
+		  busy_generators++;
+		  tg.run([=, &str, &pr_perms, &new_configs, &count_configs, &mutex] ()
+			 {
+#ifdef _ORDER_TYPES
+			   generate_configurations(*split_gen, new_config, str, pr_perms, m_pr_perms, size, limit_size,
+						   new_configs, count_configs, mutex);
+#else
+			   generate_configurations(*split_gen, new_config, str, pr_perms, size, limit_size,
+						   new_configs, count_configs, mutex);
+#endif
+			 });
+		}
+	    }
+	  
+	  new_perms.clear();
+	  decisive.clear();
+#ifdef _ORDER_TYPES
+	  m_new_perms.clear();
+	  if(is_canonical(new_config, str.size(), pr_perms, m_pr_perms, size, new_perms, m_new_perms, &decisive))
+#else
+	  if(is_canonical(new_config, str.size(), pr_perms, size, new_perms, &decisive))
+#endif
+	    {
+	      ++count;
+#ifdef _ORDER_TYPES
+	      if(m_new_perms.size() != 0)
+		count.increment_achirals();
+#endif
+	      if(size != limit_size)
+		{
+#ifdef _ORDER_TYPES
+		  configs.push_back(conf_data_dfs { new_config, str, pr_perms, new_perms, m_pr_perms, m_new_perms });
+#else
+		  configs.push_back(conf_data_dfs { new_config, str, pr_perms, new_perms });
+#endif
+		}
+	    }
+	  else
+	    conf_gen.add_nogood(new_config, decisive);
+	}
+      busy_generators--;
+      tg.wait();
+    });
+
+  tbb::spin_mutex::scoped_lock lock(mutex);
+  new_configs.insert(new_configs.end(), configs.begin(), configs.end());
+  count_configs += count;
+}
+#endif
+
 #if defined PRINT && !defined _PARALLEL
 ret_type dfs_enumerate(const conf_data_dfs & prev_cd, unsigned prev_size, unsigned limit_size, unsigned long counter)
 #else
@@ -126,8 +227,12 @@ ret_type dfs_enumerate(const conf_data_dfs & prev_cd, unsigned prev_size, unsign
 #ifdef _ORDER_TYPES
   std::vector<permutation_ptr> m_new_perms;
 #endif
+  std::vector<unsigned> decisive;
   
   std::vector<conf_data_dfs> new_configs;
+#ifdef _PARALLEL
+  tbb::spin_mutex mutex;
+#endif
   
   // For each augmented structure...
   for(unsigned k = 0; k < augmented_structs.size(); k++)
@@ -137,8 +242,6 @@ ret_type dfs_enumerate(const conf_data_dfs & prev_cd, unsigned prev_size, unsign
       // augmented and the selected structure
       const structure & str = augmented_structs[k];
       
-      conf_gen.set_structure(prev_config, str);	      
-      
       // If the innermost hull contains only the new
       // point, then we should consider only the
       // automorphisms of the prev_config. Otherwise, the
@@ -148,17 +251,56 @@ ret_type dfs_enumerate(const conf_data_dfs & prev_cd, unsigned prev_size, unsign
       const std::vector<permutation_ptr> & pr_perms = str.back() == 1 ? prev_perms : prev_perms_p;
 #ifdef _ORDER_TYPES
       const std::vector<permutation_ptr> & m_pr_perms = str.back() == 1 ? m_prev_perms : m_prev_perms_p;
+#endif
+#ifdef _ORDER_TYPES
+      conf_gen.set_structure(prev_config, str, pr_perms, m_pr_perms);
+#else
+      conf_gen.set_structure(prev_config, str, pr_perms);
+#endif
+
+#if defined BDD_CONVEX && (!defined PRINT || defined _PARALLEL)
+      // At the last level, the configurations are only counted, so
+      // if all of them are canonical, the count is taken from the
+      // solver (there are no achiral ones, since there are no
+      // mirrored automorphisms)
+#ifdef _ORDER_TYPES
+      if(size == limit_size && all_canonical(str.size(), pr_perms, m_pr_perms, size))
+#else
+      if(size == limit_size && all_canonical(str.size(), pr_perms, size))
+#endif
+	{
+	  unsigned long count;
+	  if(conf_gen.count_configurations(count))
+	    {
+#ifdef _STATS
+	      g_generation_stats._canonical.fetch_add(count, std::memory_order_relaxed);
+#endif
+	      count_configs += ret_type(count);
+	      continue;
+	    }
+	}
 #endif
       configuration new_config = smallest_configuration(size);
-      
+
+#ifdef _PARALLEL
+      busy_generators++;
+#ifdef _ORDER_TYPES
+      generate_configurations(conf_gen, new_config, str, pr_perms, m_pr_perms, size, limit_size,
+			      new_configs, count_configs, mutex);
+#else
+      generate_configurations(conf_gen, new_config, str, pr_perms, size, limit_size,
+			      new_configs, count_configs, mutex);
+#endif
+#else
       while(conf_gen.generate_next_configuration(new_config))
 	{
 	  new_perms.clear();
+	  decisive.clear();
 #ifdef _ORDER_TYPES
 	  m_new_perms.clear();
-	  if(is_canonical(new_config, str.size(), pr_perms, m_pr_perms, size, new_perms, m_new_perms))
+	  if(is_canonical(new_config, str.size(), pr_perms, m_pr_perms, size, new_perms, m_new_perms, &decisive))
 #else
-	  if(is_canonical(new_config, str.size(), pr_perms, size, new_perms))
+	  if(is_canonical(new_config, str.size(), pr_perms, size, new_perms, &decisive))
 #endif
 	    {
 	      ++count_configs;
@@ -190,7 +332,10 @@ ret_type dfs_enumerate(const conf_data_dfs & prev_cd, unsigned prev_size, unsign
 #endif
 		}
 	    }
+	  else
+	    conf_gen.add_nogood(new_config, decisive);
 	}	      
+#endif
     }
   
 #if defined PRINT && !defined _PARALLEL
@@ -301,13 +446,25 @@ int main(int argc, char ** argv)
     {
       num_of_threads = atoi(argv[2]);
     }
-  tbb::task_scheduler_init ts(num_of_threads != 0 ? num_of_threads : tbb::task_scheduler_init::default_num_threads());
+#if TBB_VERSION_MAJOR >= 2021
+  num_of_threads_used = num_of_threads != 0 ? num_of_threads : tbb::info::default_concurrency();
+  tbb::global_control gc(tbb::global_control::max_allowed_parallelism, num_of_threads_used);
+#else
+  num_of_threads_used = num_of_threads != 0 ? num_of_threads : tbb::task_scheduler_init::default_num_threads();
+  tbb::task_scheduler_init ts(num_of_threads_used);
+#endif
 #endif
       
   cyclic_store::init_instance(max_size);
   smallest_configurations::init_instance(max_size);
   
   enumerate_configurations_dfs(max_size);
+#ifdef _STATS
+  print_generation_stats(std::cout);
+#ifndef PICO_CONVEX
+  print_solver_stats(std::cout);
+#endif
+#endif
 
   smallest_configurations::delete_instance();
   cyclic_store::delete_instance();
@@ -6,10 +6,16 @@
 #include <cassert>
 #include <iostream>
 #include <vector>
+#include <deque>
 #include <utility>
 #include <functional>
 #include <algorithm>
+#include <iomanip>
 #include <unordered_map>
+#include <memory>
+#ifdef _STATS
+#include <atomic>
+#endif
 
 typedef unsigned variable;  
 
@@ -78,10 +84,16 @@ private:
   std::vector<extended_boolean> _values;
   std::vector< std::pair<literal, unsigned> > _stack;
   unsigned _curr_level;
+#ifdef _CDCL
+  std::vector<unsigned> _levels;
+#endif
 public:
   valuation(unsigned num_of_vars)
     :_values(num_of_vars, B_UNDEFINED),
      _curr_level(0)
+#ifdef _CDCL
+    ,_levels(num_of_vars, 0)
+#endif
   {}
 
   literal operator [] (unsigned i) const
@@ -111,6 +123,9 @@ public:
 
     _stack.push_back({ l, _curr_level });
     _values[var_from_lit(l)] = is_positive(l) ? B_TRUE : B_FALSE;
+#ifdef _CDCL
+    _levels[var_from_lit(l)] = _curr_level;
+#endif
   }
 
   void clear()
@@ -119,6 +134,35 @@ public:
     _values.assign(_values.size(), B_UNDEFINED);
     _curr_level = 0;
   }
+
+  // Restores the stack to its first size literals (which must all be
+  // on level 0). The removed literals are appended to removed.
+  void restore_stack(unsigned size, std::vector<literal> & removed)
+  {
+    while(_stack.size() > size)
+      {
+	literal l = _stack.back().first;
+	_values[var_from_lit(l)] = B_UNDEFINED;
+	removed.push_back(l);
+	_stack.pop_back();
+      }
+    _curr_level = 0;
+  }
+  
+  // Makes the literals of the first decision level (its decision
+  // included) level 0 literals
+  void merge_first_level()
+  {
+    for(auto & p : _stack)
+      if(p.second > 0)
+	{
+	  p.second--;
+#ifdef _CDCL
+	  _levels[var_from_lit(p.first)]--;
+#endif
+	}
+    _curr_level--;
+  }
   
   literal backtrack()
   {
@@ -133,6 +177,28 @@ public:
     return l;
   }
 
+#ifdef _CDCL
+  // Removes the literals of the levels above the given level, and
+  // returns the decision of the level level + 1
+  literal backjump(unsigned level)
+  {
+    literal l;
+    while(!_stack.empty() && _stack.back().second > level)
+      {
+	_values[var_from_lit(_stack.back().first)] = B_UNDEFINED;
+	l = _stack.back().first;
+	_stack.pop_back();
+      }
+    _curr_level = level;
+    return l;
+  }
+
+  unsigned variable_level(variable v) const
+  {
+    return _levels[v];
+  }
+#endif
+  
   extended_boolean variable_value(variable v) const
   {
     return _values[v];
@@ -179,6 +245,37 @@ std::ostream & operator << (std::ostream & ostr, const clause & cl)
 }
 
 
+#ifdef _STATS
+// Statistics collected by all the solvers (compile with -D_STATS)
+struct solver_stats {
+  std::atomic<unsigned long> _binary_propagations { 0 };
+  std::atomic<unsigned long> _long_propagations { 0 };
+  std::atomic<unsigned long> _amo_propagations { 0 };
+  std::atomic<unsigned long> _conflicts { 0 };
+  std::atomic<unsigned long> _backjumps { 0 };
+};
+
+inline solver_stats g_solver_stats;
+
+inline
+void print_solver_stats(std::ostream & ostr)
+{
+  unsigned long binary = g_solver_stats._binary_propagations;
+  unsigned long amo = g_solver_stats._amo_propagations;
+  unsigned long total = binary + amo + g_solver_stats._long_propagations;
+  ostr << "Propagations: " << total << " (binary clauses: " << binary;
+  if(total != 0)
+    ostr << ", " << std::fixed << std::setprecision(1) << 100.0 * binary / total << "%";
+  ostr << "; at-most-one: " << amo;
+  if(total != 0)
+    ostr << ", " << std::fixed << std::setprecision(1) << 100.0 * amo / total << "%";
+  ostr << ")" << std::endl;
+#ifdef _CDCL
+  ostr << "Conflicts: " << g_solver_stats._conflicts << " (learned with backjump: " << g_solver_stats._backjumps << ")" << std::endl;
+#endif
+}
+#endif
+
 class solver {
 private:
   valuation _val;
@@ -188,15 +285,86 @@ private:
   unsigned _next_decision = 0;
   bool _next_model = false;
   
-  std::vector< clause * > _long_clauses;
+  // The solver keeps its own copies of the long clauses, since the
+  // order of their literals is a part of the watch state (the deque
+  // keeps their addresses stable)
+  std::deque< clause > _long_clauses;
   std::vector< literal > _units;
   std::vector< unsigned > _long_clauses_contexts;
   std::vector< unsigned > _units_contexts;
 
   std::vector< std::vector<clause *> > _inactive_lists;
 
+  // Binary clauses are not watched: for each literal l, the list
+  // _implications[l] contains the literals implied by l (of the
+  // binary clauses of the contexts, and of the binary nogoods and
+  // learned clauses, which are kept as clauses too)
+  std::vector< std::vector<literal> > _implications;
+  std::vector< std::pair<literal, literal> > _binary_clauses;
+  std::vector< unsigned > _binary_clauses_contexts;
+
+  // At-most-one constraints: _amo_lists[l] contains the indices of
+  // the constraints that contain the literal l. When l becomes true,
+  // the other literals of these constraints are made false.
+  std::vector< clause > _amo_constraints;
+  std::vector< std::vector<unsigned> > _amo_lists;
+  std::vector< unsigned > _amo_contexts;
+
   unsigned _empty_clause_context = (unsigned)(-1);
 
+  std::vector< unsigned > _stack_contexts;
+  std::vector< bool > _conflict_contexts;
+  std::vector<literal> _removed_literals;
+
+  // The literals of the stack before _simplified_pos were already
+  // used for the level 0 simplification
+  unsigned _simplified_pos = 0;
+  std::vector< bool > _simplified_vars;
+  std::vector< literal > _simplified_others;
+
+  // Check of the partial assignments (see set_prefix_check()): the
+  // prefix of the variables from _prefix_first up to _checked_prefix
+  // was already checked on the current branch
+  std::function<bool (const valuation &, unsigned)> _prefix_check;
+  unsigned _prefix_first = 0;
+  unsigned _checked_prefix = 0;
+
+  // Nogoods added during the search (see add_nogood()) are kept
+  // until a clause context is restored. The last one stays pending
+  // while it is false, and is propagated when it becomes unit.
+  std::vector< std::unique_ptr<clause> > _nogoods;
+  clause * _pending_nogood = nullptr;
+  std::vector< bool > _nogood_vars;
+  // The one-literal nogoods cannot be watched: their literals are set
+  // whenever the search unassigns variables (see set_unit_nogoods())
+  std::vector< literal > _unit_nogoods;
+  bool _unit_nogoods_pending = false;
+
+  // Cube mode (see set_cube_mode())
+  bool _cubes = false;
+
+#ifdef _CDCL
+  // Conflict driven learning (compile with -D_CDCL). The reason of a
+  // propagated literal is either a long clause, or a single false
+  // literal (for binary clauses and at-most-one constraints).
+  std::vector< clause * > _reason_clauses;
+  std::vector< literal > _reason_literals;
+  clause _conflict_literals;
+
+  // Learned clauses are kept until a clause context is restored
+  std::vector< std::unique_ptr<clause> > _learned_clauses;
+
+  // The levels (above 0) that contain a flipped decision, i.e. whose
+  // search spaces are partially enumerated. The search never
+  // backjumps below the highest of them, so no model is repeated.
+  std::vector< unsigned > _flip_levels;
+  
+  // The buffers of analyze_conflict(), reused between the conflicts
+  std::vector< bool > _seen;
+  std::vector< variable > _touched;
+  clause _learned;
+#endif
+
 
   //unsigned long _decide_count = 0;
   //unsigned long _backtrack_count = 0;
@@ -204,12 +372,104 @@ private:
 
   
 public:
+  static constexpr literal NO_LITERAL = (literal)(-1);
+  
   solver(unsigned num_of_vars)
     :_val(num_of_vars),
      _watch_lists(num_of_vars << 1),
-     _inactive_lists(num_of_vars << 1)
+     _inactive_lists(num_of_vars << 1),
+     _implications(num_of_vars << 1),
+     _amo_lists(num_of_vars << 1),
+     _simplified_vars(num_of_vars, false),
+     _nogood_vars(num_of_vars, false)
+#ifdef _CDCL
+    ,_reason_clauses(num_of_vars, nullptr),
+     _reason_literals(num_of_vars, NO_LITERAL),
+     _seen(num_of_vars, false)
+#endif
   {}
 
+  // Creates a snapshot of the solver s (its clauses, trail, watch
+  // lists and search state). The clauses of the snapshot are the
+  // copies of the clauses of s, which is used by split().
+  struct snapshot_tag {};
+  solver(const solver & s, snapshot_tag)
+    :_val(s._val),
+     _watch_lists(s._watch_lists),
+     _conflict(s._conflict),
+     _pending_pos(s._pending_pos),
+     _next_decision(s._next_decision),
+     _next_model(s._next_model),
+     _long_clauses(s._long_clauses),
+     _units(s._units),
+     _long_clauses_contexts(s._long_clauses_contexts),
+     _units_contexts(s._units_contexts),
+     _inactive_lists(s._inactive_lists),
+     _implications(s._implications),
+     _binary_clauses(s._binary_clauses),
+     _binary_clauses_contexts(s._binary_clauses_contexts),
+     _amo_constraints(s._amo_constraints),
+     _amo_lists(s._amo_lists),
+     _amo_contexts(s._amo_contexts),
+     _empty_clause_context(s._empty_clause_context),
+     _stack_contexts(s._stack_contexts),
+     _conflict_contexts(s._conflict_contexts),
+     _removed_literals(s._removed_literals),
+     _simplified_pos(s._simplified_pos),
+     _simplified_vars(s._simplified_vars),
+     _prefix_first(s._prefix_first),
+     _checked_prefix(s._checked_prefix),
+     _nogood_vars(s._nogood_vars),
+     _unit_nogoods(s._unit_nogoods),
+     _unit_nogoods_pending(s._unit_nogoods_pending),
+     _cubes(s._cubes)
+#ifdef _CDCL
+    ,_reason_clauses(s._reason_clauses),
+     _reason_literals(s._reason_literals),
+     _conflict_literals(s._conflict_literals),
+     _flip_levels(s._flip_levels),
+     _seen(s._seen)
+#endif
+  {
+    // All the watched clauses belong to the solver, so the pointers
+    // to them are mapped to the copies
+    std::unordered_map<const clause *, clause *> own_map;
+    own_map.reserve(_long_clauses.size() + s._nogoods.size());
+    for(unsigned k = 0; k < _long_clauses.size(); k++)
+      own_map[&s._long_clauses[k]] = &_long_clauses[k];
+    for(const auto & cl : s._nogoods)
+      {
+	_nogoods.push_back(std::make_unique<clause>(*cl));
+	own_map[cl.get()] = _nogoods.back().get();
+      }
+#ifdef _CDCL
+    for(const auto & cl : s._learned_clauses)
+      {
+	_learned_clauses.push_back(std::make_unique<clause>(*cl));
+	own_map[cl.get()] = _learned_clauses.back().get();
+      }
+#endif
+    auto full_map = [&own_map] (clause * cl) -> clause *
+		    {
+		      return own_map.at(cl);
+		    };
+    if(s._pending_nogood != nullptr)
+      _pending_nogood = full_map(s._pending_nogood);
+#ifdef _CDCL
+    for(unsigned v = 0; v < _reason_clauses.size(); v++)
+      if(_reason_clauses[v] != nullptr)
+	_reason_clauses[v] = _val.variable_value(v) != B_UNDEFINED && _val.variable_level(v) > 0 ?
+	  full_map(_reason_clauses[v]) : nullptr;
+#endif
+    
+    for(auto & w_list : _watch_lists)
+      for(auto & cl : w_list)
+	cl = full_map(cl);
+    for(auto & i_list : _inactive_lists)
+      for(auto & cl : i_list)
+	cl = full_map(cl);
+  }
+  
   solver(const solver &) = delete;
   solver(solver &&) = delete;
 
@@ -218,17 +478,46 @@ public:
     return _val;
   }
 
+  // During the search, check(val, p) is called whenever the prefix
+  // first, first + 1, ..., p - 1 of the variables becomes fully
+  // assigned (for a longer p than on the current branch so far). If
+  // it returns false, no extension of the prefix is a model, and the
+  // search backtracks. The check is not copied to the snapshots.
+  void set_prefix_check(unsigned first, std::function<bool (const valuation &, unsigned)> check)
+  {
+    _prefix_check = check;
+    _prefix_first = first;
+    _checked_prefix = first;
+  }
+
+  // In the cube mode, the search returns a model as soon as all the
+  // clauses are satisfied, leaving the remaining variables undefined:
+  // every completion is a model, and the search continues after all
+  // of them (in the order of the variables, false first, so the
+  // completions are in the order in which they would be enumerated)
+  void set_cube_mode(bool cubes)
+  {
+    _cubes = cubes;
+  }
+
+  // Besides the clauses, the context remembers the level 0 state of
+  // the solver (should be called on level 0, with all the
+  // propagations done), which is restored with the context.
   void add_clause_context()
   {
     _long_clauses_contexts.push_back(_long_clauses.size());
     _units_contexts.push_back(_units.size());
+    _binary_clauses_contexts.push_back(_binary_clauses.size());
+    _amo_contexts.push_back(_amo_constraints.size());
+    _stack_contexts.push_back(_val.stack_size());
+    _conflict_contexts.push_back(_conflict);
   }
 
-  void add_clauses(std::vector<clause> & clauses)
+  void add_clauses(const std::vector<clause> & clauses)
   {
     for(unsigned k = 0; k < clauses.size(); k++)
       {	
-	clause & cl = clauses[k];
+	const clause & cl = clauses[k];
 
 	if(cl.size() == 0)
 	  {
@@ -242,10 +531,73 @@ public:
 	    _units.push_back(cl[0]);
 	    continue;
 	  }
+
+	if(cl.size() == 2)
+	  {
+	    _implications[opposite_literal(cl[0])].push_back(cl[1]);
+	    _implications[opposite_literal(cl[1])].push_back(cl[0]);
+	    _binary_clauses.push_back({ cl[0], cl[1] });
+	    continue;
+	  }
 	    
-	_long_clauses.push_back(&cl);
-	_inactive_lists[cl[0]].push_back(&cl);
+	_long_clauses.push_back(cl);
+	_inactive_lists[cl[0]].push_back(&_long_clauses.back());
+      }
+  }
+
+  // Adds the constraint that at most one of the literals is true
+  // (exactly one, together with the clause of the same literals)
+  void add_at_most_one(const clause & lits)
+  {
+    for(literal l : lits)
+      _amo_lists[l].push_back(_amo_constraints.size());
+    _amo_constraints.push_back(lits);
+  }
+
+  // Adds the clause that is false in the current valuation (e.g. a
+  // model, or a partial assignment that is rejected) to the last
+  // clause context during the search. The search backtracks until
+  // the clause is not false. Its watched literals are the ones that
+  // were assigned last (a binary nogood is added to the implication
+  // lists instead, and a unit one is set by set_unit_nogoods()).
+  void add_nogood(const clause & cl)
+  {
+    if(cl.size() == 1)
+      {
+	_unit_nogoods.push_back(cl[0]);
+	_unit_nogoods_pending = true;
+	return;
       }
+    if(cl.empty())
+      return;
+    
+    _nogoods.push_back(std::make_unique<clause>(cl));
+    clause & ng = *_nogoods.back();
+    _pending_nogood = &ng;
+    if(ng.size() == 2)
+      {
+	_implications[opposite_literal(ng[0])].push_back(ng[1]);
+	_implications[opposite_literal(ng[1])].push_back(ng[0]);
+	return;
+      }
+    
+    for(literal l : ng)
+      _nogood_vars[var_from_lit(l)] = true;
+    unsigned found = 0;
+    for(unsigned i = _val.stack_size(); i-- > 0 && found < 2; )
+      {
+	variable v = var_from_lit(_val[i]);
+	if(_nogood_vars[v])
+	  {
+	    auto it = std::find_if(ng.begin() + found, ng.end(), [v] (literal l) { return var_from_lit(l) == v; });
+	    std::swap(ng[found++], *it);
+	  }
+      }
+    for(literal l : ng)
+      _nogood_vars[var_from_lit(l)] = false;
+    
+    _watch_lists[ng[0]].push_back(&ng);
+    _watch_lists[ng[1]].push_back(&ng);
   }
 
   unsigned num_of_watched_clauses()
@@ -267,36 +619,94 @@ public:
     return count;    
   }
   
+  // Removes the clause from the watch lists (or from the inactive
+  // list where it is kept), or a binary nogood or learned clause from
+  // the implication lists. The latter are searched from the ends, so
+  // the other entries stay in their order (and the binary clauses of
+  // the contexts can be removed from the ends later).
+  void remove_watched_clause(clause & cl)
+  {
+    if(cl.size() == 2)
+      {
+	for(unsigned i = 0; i < 2; i++)
+	  {
+	    std::vector<literal> & imp = _implications[opposite_literal(cl[i])];
+	    imp.erase(std::find(imp.rbegin(), imp.rend(), cl[1 - i]).base() - 1);
+	  }
+	return;
+      }
+    
+
+    std::vector<clause *> & wlist0 = _watch_lists[cl[0]];	    
+    auto it0 = std::find(wlist0.begin(), wlist0.end(), &cl);
+    if(it0 == wlist0.end())
+      {
+	std::vector<clause *> & ilist = _inactive_lists[cl[0]];
+	ilist.erase(std::find(ilist.begin(), ilist.end(), &cl));
+      }
+    else
+      {
+	wlist0.erase(it0);
+	std::vector<clause *> & wlist1 = _watch_lists[cl[1]];
+	wlist1.erase(std::find(wlist1.begin(), wlist1.end(), &cl));
+      }      
+  }
+  
   void restore_clause_context(unsigned k)
   {
     if(k >= _long_clauses_contexts.size())
       return;
+
+#ifdef _CDCL
+    while(!_learned_clauses.empty())
+      {
+	remove_watched_clause(*_learned_clauses.back());
+	_learned_clauses.pop_back();
+      }
+#endif
+    while(!_nogoods.empty())
+      {
+	remove_watched_clause(*_nogoods.back());
+	_nogoods.pop_back();
+      }
+    _pending_nogood = nullptr;
+    _unit_nogoods.clear();
+    _unit_nogoods_pending = false;
  
     while(_long_clauses.size() > _long_clauses_contexts[k])
       {
-	clause & cl = *_long_clauses.back();
-	std::vector<clause *> & wlist0 = _watch_lists[cl[0]];	    
-	auto it0 = std::find(wlist0.begin(), wlist0.end(), &cl);
-	if(it0 == wlist0.end())
-	  {
-	    std::vector<clause *> & ilist = _inactive_lists[cl[0]];
-	    ilist.erase(std::find(ilist.begin(), ilist.end(), &cl));
-	  }
-	else
-	  {
-	    wlist0.erase(it0);
-	    std::vector<clause *> & wlist1 = _watch_lists[cl[1]];
-	    wlist1.erase(std::find(wlist1.begin(), wlist1.end(), &cl));
-	  }      
+	remove_watched_clause(_long_clauses.back());
 	_long_clauses.pop_back();
       }
     _long_clauses_contexts.resize(k);
     
     _units.resize(_units_contexts[k]);
     _units_contexts.resize(k);
+
+    // Binary clauses are removed in the reverse order, so they are
+    // always at the ends of the implication lists
+    while(_binary_clauses.size() > _binary_clauses_contexts[k])
+      {
+	_implications[opposite_literal(_binary_clauses.back().first)].pop_back();
+	_implications[opposite_literal(_binary_clauses.back().second)].pop_back();
+	_binary_clauses.pop_back();
+      }
+    _binary_clauses_contexts.resize(k);
+
+    while(_amo_constraints.size() > _amo_contexts[k])
+      {
+	for(literal l : _amo_constraints.back())
+	  _amo_lists[l].pop_back();
+	_amo_constraints.pop_back();
+      }
+    _amo_contexts.resize(k);
     
     if(_empty_clause_context > _long_clauses_contexts.size())
       _empty_clause_context = (unsigned)(-1);
+
+    restore_state(_stack_contexts[k], _conflict_contexts[k]);
+    _stack_contexts.resize(k);
+    _conflict_contexts.resize(k);
   }
 
   void initialize_solver()
@@ -307,12 +717,18 @@ public:
     _next_model = false;
     _pending_pos = 0;
     _next_decision = 0;
+    _simplified_pos = 0;
+    _checked_prefix = _prefix_first;
     _val.clear();
+    _unit_nogoods_pending = !_unit_nogoods.empty();
+#ifdef _CDCL
+    _flip_levels.clear();
+#endif
   }
   
-  void set_units()
+  void set_units(unsigned from = 0)
   {
-    for(unsigned i = 0; i < _units.size(); i++)
+    for(unsigned i = from; i < _units.size(); i++)
       {
 	literal l = _units[i];
 	
@@ -328,59 +744,155 @@ public:
 	  }
       } 
   }
+
+  // Moves the clauses from the inactive list of the literal l either
+  // to the watch lists, or to the inactive list of their true
+  // literal. The clauses that are unit are propagated (must be
+  // called on level 0).
+  void activate_inactive_list(literal l)
+  {
+    std::vector<clause *> & l_list = _inactive_lists[l];
+
+    unsigned j = 0;
+    for(unsigned k = 0; k < l_list.size(); k++)
+      {
+	clause & cl = *l_list[k];
+
+	if(_conflict)
+	  {
+	    l_list[j++] = &cl;
+	    continue;
+	  }
+	
+	unsigned i;
+	unsigned num_of_undef = 0;
+	extended_boolean b;
+	
+	// Non-false literals are moved to the watched positions
+	for(i = 0; i < cl.size() && (b = _val.literal_value(cl[i])) != B_TRUE; i++)
+	  {
+	    if(b == B_UNDEFINED && num_of_undef < 2)
+	      std::swap(cl[num_of_undef++], cl[i]);
+	  }
+	
+	if(i < cl.size())
+	  {
+	    std::swap(cl[0], cl[i]);
+	    if(cl[0] == l)
+	      l_list[j++] = &cl;
+	    else
+	      _inactive_lists[cl[0]].push_back(&cl);
+	    continue;
+	  }
+	
+	if(num_of_undef == 0)
+	  {
+	    _conflict = true;
+	    l_list[j++] = &cl;
+	    continue;
+	  }
+
+	if(num_of_undef == 1)
+	  apply_unit_propagation(cl[0]);
+	
+	_watch_lists[cl[0]].push_back(&cl);
+	_watch_lists[cl[1]].push_back(&cl);	
+      }
+    l_list.resize(j);
+  }
   
   void set_watch_lists()
   {    
-    for(literal l = 0; l < _inactive_lists.size(); l++)
+    for(literal l = 0; l < _inactive_lists.size() && !_conflict; l++)
       {
-	if(_val.literal_value(l) == B_TRUE)
-	  continue;
-	
-	std::vector<clause *> & l_list = _inactive_lists[l];
+	if(_val.literal_value(l) != B_TRUE)
+	  activate_inactive_list(l);
+      }
+  }
 
-	unsigned j = 0;
-	for(unsigned k = 0; k < l_list.size(); k++)
-	  {
-	    clause & cl = *l_list[k];
-	    	    
-	    unsigned i;
-	    bool found_undef = false;
-	    extended_boolean b;
-	    
-	    for(i = 0; i < cl.size() && (b = _val.literal_value(cl[i])) != B_TRUE; i++)
-	      {
-		if(b == B_UNDEFINED)
-		  found_undef = true;
-	      }
-	    
-	    if(i < cl.size())
-	      {
-		std::swap(cl[0], cl[i]);
-		_inactive_lists[cl[0]].push_back(&cl);
+  // Returns the solver to the saved level 0 state: the literals
+  // fixed after the state was saved are removed from the stack. The
+  // clauses that were made inactive because of them are activated
+  // later by set_last_context(), after the units of the new contexts
+  // are set (the lists of the literals that are fixed again need not
+  // be touched). The clauses added after the state was saved must be
+  // already removed. The stack is rewound even if the saved state is
+  // a conflict, so no later assignment survives into the next context.
+  void restore_state(unsigned stack_size, bool conflict)
+  {
+    _next_model = false;
+    _next_decision = 0;
+    
+    _val.restore_stack(stack_size, _removed_literals);
+    _pending_pos = stack_size;
+    _simplified_pos = std::min(_simplified_pos, stack_size);
+    _checked_prefix = _prefix_first;
+#ifdef _CDCL
+    _flip_levels.clear();
+#endif
+    _conflict = conflict;
+  }
 
-		continue;
-	      }
-	    
-	    if(found_undef == false)
-	      {
-		_conflict = true;
-		for(; k < l_list.size(); k++)
-		  l_list[j++] = l_list[k];
-		return;
-	      }
-	    
-	    _watch_lists[cl[0]].push_back(&cl);
-	    _watch_lists[cl[1]].push_back(&cl);	
+  // Sets the units and the watch lists for the clauses of the last
+  // clause context and propagates them (on level 0), leaving the
+  // rest of the solver state unchanged.
+  void set_last_context()
+  {
+    if(_conflict)
+      return;
+    
+    set_units(_units_contexts.back());
+    for(unsigned i = 0; i < _removed_literals.size() && !_conflict; i++)
+      {
+	literal l = _removed_literals[i];
+	if(_val.literal_value(l) != B_TRUE)
+	  activate_inactive_list(l);
+      }
+    if(_conflict)
+      return;
+    _removed_literals.clear();
+
+    // The new binary clauses may be unit because of the literals that
+    // are already propagated
+    for(unsigned k = _binary_clauses_contexts.back(); k < _binary_clauses.size(); k++)
+      {
+	literal l1 = _binary_clauses[k].first;
+	literal l2 = _binary_clauses[k].second;
+	extended_boolean b1 = _val.literal_value(l1);
+	extended_boolean b2 = _val.literal_value(l2);
+	if(b1 == B_FALSE && b2 == B_FALSE)
+	  {
+	    _conflict = true;
+	    return;
 	  }
-	l_list.resize(j);
+	else if(b1 == B_FALSE && b2 == B_UNDEFINED)
+	  apply_unit_propagation(l2);
+	else if(b2 == B_FALSE && b1 == B_UNDEFINED)
+	  apply_unit_propagation(l1);
       }
+    
+    for(unsigned k = _amo_contexts.back(); k < _amo_constraints.size(); k++)
+      {
+	const clause & amo = _amo_constraints[k];
+	auto it = std::find_if(amo.begin(), amo.end(), [this] (literal l) { return _val.literal_value(l) == B_TRUE; });
+	if(it != amo.end() && !propagate_at_most_one(amo, *it))
+	  return;
+      }
+    
+    for(unsigned k = _long_clauses_contexts.back(); k < _long_clauses.size() && !_conflict; k++)
+      {
+	literal l = _long_clauses[k][0];
+	if(_val.literal_value(l) != B_TRUE)
+	  activate_inactive_list(l);
+      }
+    check_conflict_and_propagations();
   }
-
+  
   void simplify_clauses()
   {
     check_conflict_and_propagations();
     if(!_conflict)
-      simplify();
+      simplify_all();
   }
   
   bool find_alternative_watch(clause * cl, unsigned & i)
@@ -393,6 +905,34 @@ public:
     return false;
   }
   
+  // Makes the literals of the at-most-one constraint amo other than
+  // the true literal l false (returns false in case of a conflict)
+  bool propagate_at_most_one(const clause & amo, literal l)
+  {
+    for(literal m : amo)
+      {
+	if(m == l)
+	  continue;
+	extended_boolean b = _val.literal_value(m);
+	if(b == B_TRUE)
+	  {
+	    _conflict = true;
+#ifdef _CDCL
+	    _conflict_literals = { opposite_literal(l), opposite_literal(m) };
+#endif
+	    return false;
+	  }
+	else if(b == B_UNDEFINED)
+	  {
+	    apply_unit_propagation(opposite_literal(m), nullptr, opposite_literal(l));
+#ifdef _STATS
+	    g_solver_stats._amo_propagations.fetch_add(1, std::memory_order_relaxed);
+#endif
+	  }
+      }
+    return true;
+  }
+  
   void check_conflict_and_propagations()
   {
     if(_conflict)
@@ -403,6 +943,34 @@ public:
 	literal l = _val[_pending_pos];
 	literal lop = opposite_literal(l);
 
+	// Binary clauses and at-most-one constraints are propagated
+	// first
+	const std::vector<literal> & imp = _implications[l];
+	for(unsigned i = 0; i < imp.size(); i++)
+	  {
+	    extended_boolean b = _val.literal_value(imp[i]);
+	    if(b == B_FALSE)
+	      {
+		_conflict = true;
+#ifdef _CDCL
+		_conflict_literals = { lop, imp[i] };
+#endif
+		return;
+	      }
+	    else if(b == B_UNDEFINED)
+	      {
+		apply_unit_propagation(imp[i], nullptr, lop);
+#ifdef _STATS
+		g_solver_stats._binary_propagations.fetch_add(1, std::memory_order_relaxed);
+#endif
+	      }
+	  }
+
+	const std::vector<unsigned> & amo_list = _amo_lists[l];
+	for(unsigned i = 0; i < amo_list.size(); i++)
+	  if(!propagate_at_most_one(_amo_constraints[amo_list[i]], l))
+	    return;
+
 	std::vector<clause *> & w_lop = _watch_lists[lop];
 	
 	unsigned k = 0;	
@@ -420,6 +988,9 @@ public:
 
 		if(owv == B_FALSE)
 		  {
+#ifdef _CDCL
+		    _conflict_literals = *w_lop[i];
+#endif
 		    for(unsigned j = i + 1; j < w_lop.size(); j++)
 		      w_lop[k++] = w_lop[j];
 		    w_lop.resize(k);
@@ -429,7 +1000,10 @@ public:
 		  }
 		else if(owv == B_UNDEFINED)
 		  {
-		    apply_unit_propagation(ow);
+		    apply_unit_propagation(ow, w_lop[i]);
+#ifdef _STATS
+		    g_solver_stats._long_propagations.fetch_add(1, std::memory_order_relaxed);
+#endif
 		  }
 	      }
 	    else
@@ -456,7 +1030,11 @@ public:
     return false;
   }
   
-  void simplify()
+  // Full level 0 simplification: all the watched clauses that are
+  // satisfied are moved to the inactive lists of their true
+  // literals. It is cheaper than simplify() when many literals are
+  // fixed at once (e.g. by a new clause context).
+  void simplify_all()
   {
     for(unsigned l = 0; l < _watch_lists.size(); l++)
       {
@@ -480,8 +1058,94 @@ public:
 	  }
 	w_list.resize(k);	
       }
+    _simplified_pos = _val.stack_size();
+  }
+  
+  // Level 0 simplification: the clauses watched by the literals
+  // fixed on level 0 since the last simplification are satisfied, so
+  // they are moved to the inactive lists of these literals (and
+  // removed from the watch lists of their other watched literals).
+  void simplify()
+  {
+    _simplified_others.clear();
+    unsigned start = _simplified_pos;
+    
+    // A clause that has a watched literal fixed in this round is
+    // moved when the first such literal is visited
+    auto moved = [this] (literal l) -> bool
+		 {
+		   return _simplified_vars[var_from_lit(l)] && _val.literal_value(l) == B_TRUE;
+		 };
+    
+    for(; _simplified_pos < _val.stack_size(); _simplified_pos++)
+      {
+	literal t = _val[_simplified_pos];
+	_simplified_vars[var_from_lit(t)] = true;
+	
+	std::vector<clause *> & w_list = _watch_lists[t];
+	for(clause * c : w_list)
+	  {
+	    clause & cl = *c;
+	    literal o = cl[0] == t ? cl[1] : cl[0];
+	    if(moved(o))
+	      continue;
+	    
+	    if(cl[1] == t)
+	      std::swap(cl[0], cl[1]);
+	    _inactive_lists[t].push_back(c);
+	    _simplified_others.push_back(o);
+	  }
+	w_list.clear();
+      }
+    
+    std::sort(_simplified_others.begin(), _simplified_others.end());
+    _simplified_others.erase(std::unique(_simplified_others.begin(), _simplified_others.end()), _simplified_others.end());
+    for(literal o : _simplified_others)
+      {
+	std::vector<clause *> & w_list = _watch_lists[o];
+	w_list.erase(std::remove_if(w_list.begin(), w_list.end(), [o, &moved] (clause * c)
+				    {
+				      return moved((*c)[0] == o ? (*c)[1] : (*c)[0]);
+				    }), w_list.end());
+      }
+
+    for(unsigned i = start; i < _simplified_pos; i++)
+      _simplified_vars[var_from_lit(_val[i])] = false;
   }
   
+  // Checks if all the clauses are satisfied by the current partial
+  // valuation (with all the propagations done). A clause that is not
+  // satisfied has an undefined watched literal, so only the lists of
+  // the undefined variables (all from _next_decision on) are visited:
+  // their watched clauses, their binary clauses and their
+  // at-most-one constraints (which are not satisfied by all the
+  // completions if two of their literals are undefined).
+  bool all_clauses_satisfied() const
+  {
+    auto is_true = [this] (literal q) { return _val.literal_value(q) == B_TRUE; };
+    auto is_undefined = [this] (literal q) { return _val.literal_value(q) == B_UNDEFINED; };
+    
+    unsigned num_of_vars = _val.num_of_vars();
+    for(variable v = _next_decision; v < num_of_vars; v++)
+      {
+	if(_val.variable_value(v) != B_UNDEFINED)
+	  continue;
+	for(literal l : { lit_from_var(v, P_POSITIVE), lit_from_var(v, P_NEGATIVE) })
+	  {
+	    for(const clause * c : _watch_lists[l])
+	      if(!is_true((*c)[0]) && !is_true((*c)[1]) && std::none_of(c->begin() + 2, c->end(), is_true))
+		return false;
+	    // The binary clauses (not l, q)
+	    if(!std::all_of(_implications[l].begin(), _implications[l].end(), is_true))
+	      return false;
+	    for(unsigned k : _amo_lists[l])
+	      if(std::count_if(_amo_constraints[k].begin(), _amo_constraints[k].end(), is_undefined) > 1)
+		return false;
+	  }
+      }
+    return true;
+  }
+
   bool choose_decision_literal(literal & l)
   {
     unsigned num_of_vars = _val.num_of_vars();
@@ -494,21 +1158,111 @@ public:
     return false;
   }
 
+  // Calls the prefix check if the assigned prefix of the checked
+  // variables is longer than on the current branch so far
+  bool check_prefix()
+  {
+    unsigned num_of_vars = _val.num_of_vars();
+    unsigned p = _prefix_first;
+    while(p < num_of_vars && _val.variable_value(p) != B_UNDEFINED)
+      p++;
+    if(p <= _checked_prefix)
+      return true;
+    _checked_prefix = p;
+    return _prefix_check(_val, p);
+  }
+
+  // Checks the pending nogood after backtracking: it is a conflict
+  // again if it is still false, and it is propagated if it became
+  // unit (only its watched literals, assigned last, can be undefined)
+  void check_pending_nogood()
+  {
+    clause & ng = *_pending_nogood;
+    unsigned num_of_undef = 0;
+    for(literal l : ng)
+      {
+	extended_boolean b = _val.literal_value(l);
+	if(b == B_TRUE)
+	  {
+	    _pending_nogood = nullptr;
+	    return;
+	  }
+	else if(b == B_UNDEFINED)
+	  num_of_undef++;
+      }
+    
+    if(num_of_undef == 0)
+      {
+	_conflict = true;
+#ifdef _CDCL
+	_conflict_literals = ng;
+#endif
+	return;
+      }
+    
+    if(num_of_undef == 1)
+      {
+	if(_val.literal_value(ng[0]) != B_UNDEFINED)
+	  std::swap(ng[0], ng[1]);
+	apply_unit_propagation(ng[0], &ng);
+#ifdef _STATS
+	if(ng.size() == 2)
+	  g_solver_stats._binary_propagations.fetch_add(1, std::memory_order_relaxed);
+	else
+	  g_solver_stats._long_propagations.fetch_add(1, std::memory_order_relaxed);
+#endif
+      }
+    _pending_nogood = nullptr;
+  }
+
+  // Sets the literals of the one-literal nogoods that were unassigned
+  // (it is a conflict if one of them is false, so the search
+  // backtracks until its variable is unassigned)
+  void set_unit_nogoods()
+  {
+    _unit_nogoods_pending = false;
+    for(literal l : _unit_nogoods)
+      {
+	extended_boolean b = _val.literal_value(l);
+	if(b == B_FALSE)
+	  {
+	    _conflict = true;
+#ifdef _CDCL
+	    _conflict_literals = { l };
+#endif
+	    return;
+	  }
+	else if(b == B_UNDEFINED)
+	  apply_unit_propagation(l);
+      }
+  }
+
   bool can_backtrack()
   {
     return _val.current_level() > 0;
   }
 
-  void apply_unit_propagation(literal l)
+  // The reason (a long clause, or a single false literal) is used
+  // only in the CDCL mode
+  void apply_unit_propagation(literal l, [[maybe_unused]] clause * reason_clause = nullptr,
+			      [[maybe_unused]] literal reason_literal = NO_LITERAL)
   {
     //std::cout << "UnitPropagate: " << int_from_lit(l) << std::endl;
     _val.push(l);
+#ifdef _CDCL
+    _reason_clauses[var_from_lit(l)] = reason_clause;
+    _reason_literals[var_from_lit(l)] = reason_literal;
+#endif
   }
   
   void apply_decide(literal l)
   {
     //std::cout << "Decide: " << int_from_lit(l) << std::endl;
     _val.push(l, true);
+#ifdef _CDCL
+    _reason_clauses[var_from_lit(l)] = nullptr;
+    _reason_literals[var_from_lit(l)] = NO_LITERAL;
+#endif
     //_decide_count++;
   }
 
@@ -519,10 +1273,176 @@ public:
     _val.push(opposite_literal(l));
     _pending_pos = _val.stack_size() - 1;
     _next_decision = var_from_lit(l) + 1;
+    _checked_prefix = _prefix_first;
     _conflict = false;
+#ifdef _CDCL
+    _reason_clauses[var_from_lit(l)] = nullptr;
+    _reason_literals[var_from_lit(l)] = NO_LITERAL;
+    unsigned level = _val.current_level();
+    while(!_flip_levels.empty() && _flip_levels.back() >= level)
+      _flip_levels.pop_back();
+    if(level > 0)
+      _flip_levels.push_back(level);
+#endif
     //_backtrack_count++;
   }
 
+#ifdef _CDCL
+  // Derives the first UIP clause from the conflict (into _learned,
+  // with the asserting literal first and a literal of the highest
+  // remaining level second). Returns false if the conflict cannot be
+  // analyzed, since a literal without a reason (a decision, or a
+  // flipped decision) is reached before the UIP.
+  bool analyze_conflict()
+  {
+    unsigned level = _val.current_level();
+    unsigned count = 0;
+    
+    _touched.clear();
+    _learned.clear();
+    _learned.push_back(NO_LITERAL);
+
+    auto add_literal = [&] (literal q)
+		       {
+			 variable v = var_from_lit(q);
+			 if(_seen[v] || _val.variable_level(v) == 0)
+			   return;
+			 _seen[v] = true;
+			 _touched.push_back(v);
+			 if(_val.variable_level(v) == level)
+			   count++;
+			 else
+			   _learned.push_back(q);
+		       };
+    
+    for(literal q : _conflict_literals)
+      add_literal(q);
+
+    bool success = count > 0;
+    unsigned pos = _val.stack_size();
+    while(success)
+      {
+	literal p;
+	do
+	  p = _val[--pos];
+	while(!_seen[var_from_lit(p)]);
+	_seen[var_from_lit(p)] = false;
+	
+	if(--count == 0)
+	  {
+	    _learned[0] = opposite_literal(p);
+	    break;
+	  }
+	
+	variable v = var_from_lit(p);
+	if(_reason_clauses[v] != nullptr)
+	  {
+	    for(literal q : *_reason_clauses[v])
+	      if(q != p)
+		add_literal(q);
+	  }
+	else if(_reason_literals[v] != NO_LITERAL)
+	  add_literal(_reason_literals[v]);
+	else
+	  success = false;
+      }
+
+    for(variable v : _touched)
+      _seen[v] = false;
+    
+    if(!success)
+      return false;
+
+    for(unsigned i = 2; i < _learned.size(); i++)
+      if(_val.variable_level(var_from_lit(_learned[i])) > _val.variable_level(var_from_lit(_learned[1])))
+	std::swap(_learned[1], _learned[i]);
+    return true;
+  }
+
+  // Learns the clause from the current conflict and backjumps to its
+  // assertion level, or to the highest level with a flipped decision,
+  // if it is higher (so the partially enumerated search spaces are
+  // kept). Returns false if the search should backtrack
+  // chronologically.
+  bool apply_backjump()
+  {
+    unsigned level = _val.current_level();
+    unsigned flip_level = _flip_levels.empty() ? 0 : _flip_levels.back();
+#ifdef _STATS
+    if(!_conflict_literals.empty())
+      g_solver_stats._conflicts.fetch_add(1, std::memory_order_relaxed);
+#endif
+    if(_conflict_literals.empty() || flip_level == level || !analyze_conflict())
+      return false;
+#ifdef _STATS
+    g_solver_stats._backjumps.fetch_add(1, std::memory_order_relaxed);
+#endif
+
+    unsigned jump_level = _learned.size() > 1 ? _val.variable_level(var_from_lit(_learned[1])) : 0;
+    jump_level = std::max(jump_level, flip_level);
+    
+    clause * reason = nullptr;
+    if(_learned.size() > 1)
+      {
+	_learned_clauses.push_back(std::make_unique<clause>(_learned));
+	reason = _learned_clauses.back().get();
+	if(_learned.size() == 2)
+	  {
+	    _implications[opposite_literal(_learned[0])].push_back(_learned[1]);
+	    _implications[opposite_literal(_learned[1])].push_back(_learned[0]);
+	  }
+	else
+	  {
+	    _watch_lists[_learned[0]].push_back(reason);
+	    _watch_lists[_learned[1]].push_back(reason);
+	  }
+      }
+
+    literal l = _val.backjump(jump_level);
+    _pending_pos = _val.stack_size();
+    _next_decision = var_from_lit(l);
+    _checked_prefix = _prefix_first;
+    apply_unit_propagation(_learned[0], reason);
+    _conflict = false;
+    return true;
+  }
+#endif
+
+  // The remaining search space can be split if there is a decision
+  // whose other branch is not explored yet (all decisions are made
+  // on negative literals, and only their flips are implied).
+  bool can_split() const
+  {
+    return _val.current_level() > 0;
+  }
+
+  // Removes the unexplored branch of the first decision from the
+  // remaining search space (its current branch is kept on level 0).
+  void keep_current_branch()
+  {
+    _val.merge_first_level();
+#ifdef _CDCL
+    unsigned j = 0;
+    for(unsigned i = 0; i < _flip_levels.size(); i++)
+      if(_flip_levels[i] > 1)
+	_flip_levels[j++] = _flip_levels[i] - 1;
+    _flip_levels.resize(j);
+#endif
+  }
+
+  // Called on a snapshot of the solver that was split: continues the
+  // search in the unexplored branch of the first decision only.
+  void take_unexplored_branch()
+  {
+    while(_val.current_level() > 1)
+      _val.backtrack();
+    apply_backtrack();
+    if(_pending_nogood != nullptr)
+      check_pending_nogood();
+    _unit_nogoods_pending = !_unit_nogoods.empty();
+    _next_model = false;
+  }
+  
   bool solve()
   {
     //_num_solve++;
@@ -533,19 +1453,33 @@ public:
     if(_next_model)
       {	
 	_conflict = true;
+#ifdef _CDCL
+	if(_pending_nogood != nullptr)
+	  _conflict_literals = *_pending_nogood;
+	else
+	  _conflict_literals.clear();
+#endif
       }
 
     bool simplified = true;
     while(true)
       {
+	if(_unit_nogoods_pending && !_conflict)
+	  set_unit_nogoods();
 	check_conflict_and_propagations();
 	if(_conflict)
 	  {
 	    if(can_backtrack())
 	      {
+#ifdef _CDCL
+		if(!apply_backjump())
+#endif
 		apply_backtrack();
 		if(_val.current_level() == 0)
 		  simplified = false;
+		if(_pending_nogood != nullptr)
+		  check_pending_nogood();
+		_unit_nogoods_pending = !_unit_nogoods.empty();
 	      }
 	    else
 	      {		    		
@@ -558,8 +1492,20 @@ public:
 	      simplify();
 	      simplified = true;
 	    }
+
+	  if(_prefix_check && !check_prefix())
+	    {
+	      _conflict = true;
+#ifdef _CDCL
+	      if(_pending_nogood != nullptr)
+		_conflict_literals = *_pending_nogood;
+	      else
+		_conflict_literals.clear();
+#endif
+	      continue;
+	    }
 	  
-	  if(choose_decision_literal(l))
+	  if(!(_cubes && all_clauses_satisfied()) && choose_decision_literal(l))
 	    {
 	      apply_decide(l);
 	    }
@@ -7,6 +7,7 @@ extern "C" {
 
 #include <vector>
 #include <cstdlib>
+#include <algorithm>
 
 typedef unsigned variable;  
 
@@ -147,12 +148,211 @@ private:
   unsigned _num_of_vars;
   unsigned _num_of_contexts;
   unit_stack _unit_stack;
+
+  // Only the variables from _first_projected on are free (see
+  // set_projection())
+  unsigned _first_projected = 0;
+
+#ifdef _PICO_ASSUMPTIONS
+  // Selector mode (compile with -D_PICO_ASSUMPTIONS): instead of
+  // picosat_push(), each context gets a selector variable, whose
+  // negation is added to the clauses of the context, and the
+  // selectors of the open contexts are assumed in each call of the
+  // solver. A closed context is retired by the negated selector, so
+  // the learned clauses that do not depend on it are kept. The
+  // solver is rebuilt from the clauses of the open contexts after
+  // max_retired retired selectors (in order to get rid of their
+  // variables and clauses).
+  static const unsigned max_retired = 1 << 14;
+  std::vector<int> _selectors;
+  unsigned _num_of_retired = 0;
+#endif
+
+  // The clauses of the open contexts (and the index of the first
+  // clause of each context), from which the cubes are found (see
+  // find_cube())
+  std::vector< std::vector<int> > _clauses;
+  std::vector<unsigned> _clauses_contexts;
+
+  // The buffers of find_cube(): the model of all the variables, the
+  // variables that may still be freed, and the true literals of the
+  // clauses that have no other true literals (the clause k has the
+  // variables from _tight_ends[k - 1] to _tight_ends[k])
+  std::vector<int> _model;
+  std::vector<bool> _freeable;
+  // The clauses (from the first _num_of_filtered ones) that are not
+  // satisfied by the variables before _first_projected, which keep
+  // their values until a context is restored
+  std::vector<unsigned> _open_clauses;
+  unsigned _num_of_filtered = 0;
+  std::vector<variable> _tight_vars;
+  std::vector<unsigned> _tight_ends;
+
+  void mark_projected()
+  {
+    for(unsigned v = _first_projected; v < _num_of_vars; v++)
+      picosat_set_more_important_lit(_picosat, v+1);
+  }
+
+  void create_picosat()
+  {
+    if(_picosat != nullptr)
+      picosat_reset(_picosat);
+    
+    _picosat = picosat_init();
+    picosat_set_verbosity(_picosat, 0);
+    picosat_set_plain(_picosat, 1);
+    picosat_set_global_default_phase(_picosat, 0);
+    picosat_adjust(_picosat, _num_of_vars);
+    if(_first_projected > 0)
+      mark_projected();
+  }
+
+  // Adds the clause (of DIMACS literals) to the last context
+  void add_clause(const std::vector<int> & lits)
+  {
+    for(int l : lits)
+      picosat_add(_picosat, l);
+#ifdef _PICO_ASSUMPTIONS
+    if(!_selectors.empty())
+      picosat_add(_picosat, -_selectors.back());
+#endif
+    _clauses.push_back(lits);
+    picosat_add(_picosat, 0);
+  }
+
+  void reset_open_clauses()
+  {
+    _open_clauses.clear();
+    _num_of_filtered = 0;
+  }
+
+  bool is_true(int l) const
+  {
+    return _model[std::abs(l) - 1] == (l > 0 ? 1 : -1);
+  }
+
+  // Leaves undefined (in _val) the projected variables that can take
+  // both values, keeping all the clauses satisfied by the fixed ones.
+  // A variable can not be freed if its literal is the only true
+  // literal of a clause, and the others are freed greedily (from the
+  // last one) while each clause whose true literals are all freeable
+  // keeps one of them, so the cube is not necessarily the largest
+  // one. The clauses are scanned only up to the literals that decide
+  // this (most of them are satisfied by several literals).
+  void find_cube()
+  {
+    unsigned num_of_freeable = 0;
+    for(unsigned v = 0; v < _num_of_vars; v++)
+      {
+	_model[v] = picosat_deref(_picosat, v+1);
+	_freeable[v] = v >= _first_projected && !_unit_stack.is_unit(v);
+	if(v >= _first_projected)
+	  _val.set_variable_value(v, (extended_boolean) _model[v]);
+      }
+
+    for(; _num_of_filtered < _clauses.size(); _num_of_filtered++)
+      if(std::none_of(_clauses[_num_of_filtered].begin(), _clauses[_num_of_filtered].end(), [this] (int l)
+		      {
+			return (unsigned)std::abs(l) <= _first_projected && is_true(l);
+		      }))
+	_open_clauses.push_back(_num_of_filtered);
+
+    for(unsigned k : _open_clauses)
+      {
+	const auto & cl = _clauses[k];
+	unsigned num_of_true = 0;
+	int last_true = 0;
+	for(int l : cl)
+	  if(is_true(l))
+	    {
+	      last_true = l;
+	      if(++num_of_true > 1)
+		break;
+	    }
+	if(num_of_true == 1)
+	  _freeable[std::abs(last_true) - 1] = false;
+      }
+
+    for(unsigned v = _first_projected; v < _num_of_vars; v++)
+      if(_freeable[v])
+	num_of_freeable++;
+    if(num_of_freeable == 0)
+      return;
+
+    _tight_vars.clear();
+    _tight_ends.clear();
+    if(num_of_freeable > 1)
+      for(unsigned k : _open_clauses)
+	{
+	  const auto & cl = _clauses[k];
+	  unsigned begin = _tight_vars.size();
+	  bool tight = true;
+	  for(int l : cl)
+	    if(is_true(l))
+	      {
+		if(!_freeable[std::abs(l) - 1])
+		  {
+		    tight = false;
+		    break;
+		  }
+		_tight_vars.push_back(std::abs(l) - 1);
+	      }
+	  if(tight)
+	    _tight_ends.push_back(_tight_vars.size());
+	  else
+	    _tight_vars.resize(begin);
+	}
+
+    for(unsigned v = _num_of_vars; v-- > _first_projected; )
+      {
+	if(!_freeable[v])
+	  continue;
+	bool free = true;
+	for(unsigned k = 0, begin = 0; free && k < _tight_ends.size(); begin = _tight_ends[k++])
+	  {
+	    auto first = _tight_vars.begin() + begin, last = _tight_vars.begin() + _tight_ends[k];
+	    if(std::find(first, last, v) != last)
+	      free = std::any_of(first, last, [this, v] (variable u)
+				 {
+				   return u != v && _val.variable_value(u) != B_UNDEFINED;
+				 });
+	  }
+	if(free)
+	  _val.set_variable_value(v, B_UNDEFINED);
+      }
+  }
+
+#ifdef _PICO_ASSUMPTIONS
+  // Creates a new solver with the clauses of the open contexts only
+  void rebuild()
+  {
+    create_picosat();
+    for(unsigned k = 0, c = 0; k < _clauses.size(); k++)
+      {
+	for(; c < _clauses_contexts.size() && _clauses_contexts[c] == k; c++)
+	  _selectors[c] = picosat_inc_max_var(_picosat);
+	
+	for(int l : _clauses[k])
+	  picosat_add(_picosat, l);
+	if(c > 0)
+	  picosat_add(_picosat, -_selectors[c - 1]);
+	picosat_add(_picosat, 0);
+      }
+    for(unsigned c = 0; c < _clauses_contexts.size(); c++)
+      if(_clauses_contexts[c] == _clauses.size())
+	_selectors[c] = picosat_inc_max_var(_picosat);
+    _num_of_retired = 0;
+  }
+#endif
 public:
   solver(unsigned num)
     :_val(num),
      _num_of_vars(num),
      _num_of_contexts(0),
-     _unit_stack(num)
+     _unit_stack(num),
+     _model(num),
+     _freeable(num)
   {
     initialize_solver();
   }
@@ -160,22 +360,25 @@ public:
   bool solve()
   {
     picosat_set_seed(_picosat, 0);
+#ifdef _PICO_ASSUMPTIONS
+    for(int sel : _selectors)
+      picosat_assume(_picosat, sel);
+#endif
     int res = picosat_sat (_picosat, -1);
     
     if(res == PICOSAT_SATISFIABLE)
       {
-	for(unsigned v = 0; v < _num_of_vars; v++)
-	  {
-	    int ret = picosat_deref(_picosat, v+1);
-	    _val.set_variable_value(v, (extended_boolean) ret);
-	  }
-		
-	for(unsigned v = 0; v < _num_of_vars; v++)
+	// The model is returned as a cube: all the completions of its
+	// undefined variables are models, and they are all blocked
+	find_cube();
+
+	std::vector<int> block;
+	for(unsigned v = _first_projected; v < _num_of_vars; v++)
 	  {
-	    if(!_unit_stack.is_unit(v))	    
-	      picosat_add(_picosat, _val.variable_value(v) == B_TRUE ? -(v+1) : (v+1));
+	    if(!_unit_stack.is_unit(v) && _val.variable_value(v) != B_UNDEFINED)
+	      block.push_back(_val.variable_value(v) == B_TRUE ? -(v+1) : (v+1));
 	  }
-	picosat_add(_picosat, 0);
+	add_clause(block);
 	
 	return true;
       }
@@ -187,52 +390,107 @@ public:
     return _val;
   }
 
+  // The variables before first are fixed by the clauses whenever the
+  // solver is called, so the models are projected onto the remaining
+  // variables: only they are read and blocked (the values of the
+  // others are not set in val()), and they are decided first
+  void set_projection(unsigned first)
+  {
+    _first_projected = first;
+    reset_open_clauses();
+    mark_projected();
+  }
+
   void initialize_solver()
   {
     _num_of_contexts = 0;
-    if(_picosat != nullptr)
-      picosat_reset(_picosat);
-    
-    _picosat = picosat_init();
-    picosat_set_verbosity(_picosat, 0);
-    picosat_set_plain(_picosat, 1);
-    picosat_set_global_default_phase(_picosat, 0);
-    picosat_adjust(_picosat, _num_of_vars);
+#ifdef _PICO_ASSUMPTIONS
+    _selectors.clear();
+    _num_of_retired = 0;
+#endif
+    _clauses.clear();
+    _clauses_contexts.clear();
+    reset_open_clauses();
+    create_picosat();
     
     _unit_stack.clear();
   }
   
   void add_clause_context()
   {
+#ifdef _PICO_ASSUMPTIONS
+    _selectors.push_back(picosat_inc_max_var(_picosat));
+#else
     picosat_push(_picosat);
+#endif
+    _clauses_contexts.push_back(_clauses.size());
     _num_of_contexts++;
     _unit_stack.new_level();
   }
   
   void add_clauses(const std::vector<clause> & clauses)
   {
+    std::vector<int> lits;
     for(unsigned k = 0; k < clauses.size(); k++)
       {
 	const clause & cl = clauses[k];
 
 	if(cl.size() == 1)
 	  _unit_stack.push_unit_variable(var_from_lit(cl[0]));
-	
+
+	lits.clear();
 	for(unsigned i = 0; i < cl.size(); i++)
 	  {
-	    picosat_add(_picosat, int_from_lit(cl[i]));
+	    lits.push_back(int_from_lit(cl[i]));
 	  }
-	picosat_add(_picosat, 0);
+	add_clause(lits);
       }
   }
 
+  // At-most-one constraint, encoded by the binary clauses
+  void add_at_most_one(const clause & lits)
+  {
+    for(unsigned i = 0; i < lits.size(); i++)
+      for(unsigned j = i + 1; j < lits.size(); j++)
+	add_clause({ -int_from_lit(lits[i]), -int_from_lit(lits[j]) });
+  }
+
+  // Adds the clause to the last clause context during the
+  // enumeration
+  void add_nogood(const clause & cl)
+  {
+    std::vector<int> lits;
+    for(unsigned i = 0; i < cl.size(); i++)
+      lits.push_back(int_from_lit(cl[i]));
+    add_clause(lits);
+  }
+
   void restore_clause_context(unsigned k)
   {
+    if(k < _num_of_contexts)
+      {
+	_clauses.resize(_clauses_contexts[k]);
+	_clauses_contexts.resize(k);
+	reset_open_clauses();
+      }
+#ifdef _PICO_ASSUMPTIONS
+    while(_num_of_contexts > k)
+      {
+	picosat_add(_picosat, -_selectors.back());
+	picosat_add(_picosat, 0);
+	_selectors.pop_back();
+	_num_of_retired++;
+	_num_of_contexts--;
+      }
+    if(_num_of_retired >= max_retired)
+      rebuild();
+#else
     while(_num_of_contexts > k)
       {
 	picosat_pop(_picosat);	
 	_num_of_contexts--;
       }
+#endif
     _unit_stack.restore_level(k);
   }
   
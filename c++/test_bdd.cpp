@@ -1,4 +1,7 @@
 #include <iostream>
+#include <cstring>
+#include <random>
+#include <algorithm>
 #include "bddsolver.hpp"
 
 using namespace std;
@@ -66,8 +69,283 @@ bool readDIMACS(std::vector<clause> & f, unsigned & num_of_vars, istream & istr)
 }
 
 
-int main()
+/* Provera resavaca (opcija --check): na slucajnim formulama, modeli
+   dijagrama (sa razvijenim kockama) porede se sa modelima koji se
+   dobijaju iscrpnom pretragom. Model se kodira brojem u kome je
+   varijabla 0 najvisi bit. */
+
+bool is_true(literal l, unsigned code, unsigned n)
+{
+  return (((code >> (n - 1 - var_from_lit(l))) & 1) != 0) == is_positive(l);
+}
+
+bool satisfies(const clause & cl, unsigned code, unsigned n)
+{
+  for(literal l : cl)
+    if(is_true(l, code, n))
+      return true;
+  return false;
+}
+
+clause random_clause(std::mt19937 & gen, unsigned n, unsigned size)
+{
+  std::vector<variable> vars(n);
+  for(unsigned v = 0; v < n; v++)
+    vars[v] = v;
+  std::shuffle(vars.begin(), vars.end(), gen);
+  clause cl;
+  for(unsigned i = 0; i < size && i < n; i++)
+    cl.push_back(lit_from_var(vars[i], gen() % 2 ? P_POSITIVE : P_NEGATIVE));
+  return cl;
+}
+
+bool satisfies_amo(const clause & amo, unsigned code, unsigned n)
+{
+  return std::count_if(amo.begin(), amo.end(), [code, n] (literal l) { return is_true(l, code, n); }) <= 1;
+}
+
+/* Modeli formule (i at-most-one ogranicenja), odredjeni iscrpnom
+   pretragom */
+std::vector<bool> all_models(unsigned n, const std::vector<clause> & clauses, const clause & amo = clause())
+{
+  std::vector<bool> models(1u << n);
+  for(unsigned code = 0; code < (1u << n); code++)
+    models[code] = satisfies_amo(amo, code, n) &&
+      std::all_of(clauses.begin(), clauses.end(), [code, n] (const clause & cl)
+		  {
+		    return satisfies(cl, code, n);
+		  });
+  return models;
+}
+
+/* Da li su vrednosti literala x leksikografski manje ili jednake
+   vrednostima literala y (false je manje od true) */
+bool lex_leq(const std::vector<literal> & x, const std::vector<literal> & y, unsigned code, unsigned n)
+{
+  for(unsigned i = 0; i < x.size(); i++)
+    if(is_true(x[i], code, n) != is_true(y[i], code, n))
+      return !is_true(x[i], code, n);
+  return true;
+}
+
+/* Nabraja modele dijagrama i poredi ih sa ocekivanim (svaki model
+   mora biti nabrojan tacno jednom), a pre toga i njihov broj */
+bool check_models(solver & sl, unsigned n, const std::vector<bool> & expected)
+{
+  unsigned long count, num = std::count(expected.begin(), expected.end(), true);
+  if(!sl.count_solutions(count) || count != num)
+    {
+      cerr << "wrong count " << count << ", expected " << num << endl;
+      return false;
+    }
+
+  std::vector<bool> found(1u << n, false);
+  while(sl.solve())
+    {
+      std::vector<variable> free;
+      unsigned base = 0;
+      for(variable v = 0; v < n; v++)
+	if(sl.val().variable_value(v) == B_UNDEFINED)
+	  free.push_back(v);
+	else if(sl.val().variable_value(v) == B_TRUE)
+	  base |= 1u << (n - 1 - v);
+	
+      for(unsigned m = 0; m < (1u << free.size()); m++)
+	{
+	  unsigned code = base;
+	  for(unsigned i = 0; i < free.size(); i++)
+	    if((m >> i) & 1)
+	      code |= 1u << (n - 1 - free[i]);
+	  if(found[code] || !expected[code])
+	    {
+	      cerr << "wrong model " << code << endl;
+	      return false;
+	    }
+	  found[code] = true;
+	}
+    }
+  if(found != expected)
+    {
+      cerr << "missing models" << endl;
+      return false;
+    }
+  return true;
+}
+
+/* Broj modela dijagrama p po obdd_nsols (nije deklarisan u bddlib.h,
+   biblioteka ga izvozi samo za ovu proveru) */
+extern "C" intptr_t count_bdd_narrow(bddsolver * s, obdd_t p);
+
+/* Poredi oba brojanja modela dijagrama p sa ocekivanim brojem */
+bool check_count(bddsolver * s, obdd_t p, const std::vector<bool> & expected)
+{
+  uint64_t hi, num = std::count(expected.begin(), expected.end(), true);
+  uint64_t lo = count_bdd(s, p, &hi);
+  intptr_t narrow = count_bdd_narrow(s, p);
+  if(hi != 0 || lo != num || narrow != (intptr_t)num)
+    {
+      cerr << "wrong count " << lo << " (narrow " << narrow << "), expected " << num << endl;
+      return false;
+    }
+  return true;
+}
+
+/* Provera brojanja na malim dijagramima, dobijenim direktno preko
+   bddlib: prevedenom, njegovoj konjunkciji sa ogranicenjem
+   kardinalnosti i njegovom leksikografskom filteru */
+bool check_counts(unsigned seed)
+{
+  std::mt19937 gen(seed);
+  unsigned n = 3 + gen() % 10;
+  std::vector<clause> clauses(1, random_clause(gen, n - 1, 1 + gen() % 3));
+  clauses[0].push_back(lit_from_var(n - 1, gen() % 2 ? P_POSITIVE : P_NEGATIVE));
+  for(unsigned k = gen() % (2 * n); k > 0; k--)
+    clauses.push_back(random_clause(gen, n, 1 + gen() % 4));
+
+  bddctx * ctx = bddctx_new();
+  bddsolver * s = solver_new(ctx);
+  bool conflict = false;
+  for(const clause & cl : clauses)
+    {
+      std::vector<int> data(cl.begin(), cl.end());
+      conflict = conflict || !solver_addclause(s, data.data(), data.data() + data.size());
+    }
+  
+  bool ok = true;
+  if(!conflict && solver_simplify(s) != -1)
+    {
+      solver_solve(s, 0, 0);
+      obdd_t root = get_root(s);
+      mark_obdd_storage(ctx);
+      std::vector<bool> expected = all_models(n, clauses);
+      ok = check_count(s, root, expected);
+
+      clause card = random_clause(gen, n, 1 + gen() % n);
+      int atleast = gen() % (card.size() + 1);
+      int atmost = atleast + gen() % (card.size() + 1 - atleast);
+      std::vector<int> lits(card.begin(), card.end());
+      std::vector<bool> card_expected = expected;
+      for(unsigned code = 0; code < (1u << n); code++)
+	{
+	  int num = std::count_if(card.begin(), card.end(), [code, n] (literal l) { return is_true(l, code, n); });
+	  card_expected[code] = card_expected[code] && atleast <= num && num <= atmost;
+	}
+      ok = ok && check_count(s, conjoin_bdd(s, root, lits.data(), lits.data() + lits.size(), atleast, atmost), card_expected);
+
+      std::vector<literal> x, y;
+      for(unsigned i = 1 + gen() % 4; i > 0; i--)
+	{
+	  clause xy = random_clause(gen, n, 2);
+	  x.push_back(xy[0]);
+	  y.push_back(xy[1]);
+	}
+      std::vector<int> xl(x.begin(), x.end()), yl(y.begin(), y.end());
+      for(unsigned code = 0; code < (1u << n); code++)
+	expected[code] = expected[code] && lex_leq(x, y, code, n);
+      ok = ok && check_count(s, filter_lex_bdd(s, root, xl.data(), yl.data(), xl.size()), expected);
+    }
+  
+  solver_delete(s);
+  bddctx_delete(ctx);
+  if(!ok)
+    cerr << "count check failed: seed " << seed << endl;
+  return ok;
+}
+
+/* Trajne klauze se dodaju samo pri prvom prevodjenju, a ostale se
+   menjaju u svakoj rundi (kao kod generatora konfiguracija) */
+bool check_formula(unsigned seed)
+{
+  std::mt19937 gen(seed);
+  unsigned n = 3 + gen() % 10;
+  solver sl(n);
+  
+  // Resavac zna samo za varijable do najvece koja se javlja u
+  // klauzama, pa se poslednja varijabla javlja u trajnoj klauzi
+  std::vector<clause> persistent(1, random_clause(gen, n - 1, 1 + gen() % 3));
+  persistent[0].push_back(lit_from_var(n - 1, gen() % 2 ? P_POSITIVE : P_NEGATIVE));
+  for(unsigned k = gen() % (2 * n); k > 0; k--)
+    persistent.push_back(random_clause(gen, n, 2 + gen() % 3));
+
+  for(unsigned round = 0; round < 4; round++)
+    {
+      std::vector<clause> clauses;
+      for(unsigned k = gen() % n; k > 0; k--)
+	clauses.push_back(random_clause(gen, n, 1 + gen() % 4));
+
+      sl.reset_solver();
+      if(round == 0)
+	sl.add_clauses(persistent, true);
+      sl.add_clauses(clauses, false);
+      sl.initialize_solver();
+
+      clauses.insert(clauses.end(), persistent.begin(), persistent.end());
+      if(!check_models(sl, n, all_models(n, clauses)))
+	{
+	  cerr << "check failed: seed " << seed << ", round " << round << endl;
+	  return false;
+	}
+
+      // Konjunkcija dijagrama sa klauzama i at-most-one
+      // ogranicenjem (svaka polazi od prevedenog dijagrama)
+      for(unsigned c = 0; c < 3; c++)
+	{
+	  std::vector<clause> conjoined = clauses;
+	  for(unsigned k = gen() % n; k > 0; k--)
+	    conjoined.push_back(random_clause(gen, n, 1 + gen() % 3));
+	  clause amo = gen() % 2 ? random_clause(gen, n, 2 + gen() % 3) : clause();
+	  sl.conjoin_clauses(std::vector<clause>(conjoined.begin() + clauses.size(), conjoined.end()), amo);
+	  std::vector<bool> expected = all_models(n, conjoined, amo);
+	  if(!check_models(sl, n, expected))
+	    {
+	      cerr << "conjoin check failed: seed " << seed << ", round " << round << endl;
+	      return false;
+	    }
+
+	  // Leksikografski filteri nad konjunkcijom (x[i] i y[i] su
+	  // literali razlicitih varijabli)
+	  sl.conjoin_clauses(std::vector<clause>(conjoined.begin() + clauses.size(), conjoined.end()), amo);
+	  for(unsigned f = gen() % 3; f > 0; f--)
+	    {
+	      std::vector<literal> x, y;
+	      for(unsigned i = 1 + gen() % 4; i > 0; i--)
+		{
+		  clause xy = random_clause(gen, n, 2);
+		  x.push_back(xy[0]);
+		  y.push_back(xy[1]);
+		}
+	      sl.filter_lex_leq(x, y);
+	      for(unsigned code = 0; code < (1u << n); code++)
+		expected[code] = expected[code] && lex_leq(x, y, code, n);
+	    }
+	  if(!check_models(sl, n, expected))
+	    {
+	      cerr << "lex filter check failed: seed " << seed << ", round " << round << endl;
+	      return false;
+	    }
+	}
+    }
+  return true;
+}
+
+
+int main(int argc, char ** argv)
 {
+  if(argc == 3 && strcmp(argv[1], "--check") == 0)
+    {
+      unsigned num_of_checks = atoi(argv[2]);
+      for(unsigned seed = 0; seed < num_of_checks; seed++)
+	if(!check_formula(seed) || !check_counts(seed))
+	  exit(1);
+      cout << "CHECK OK: " << num_of_checks << " formulas" << endl;
+      return 0;
+    }
+  else if(argc > 1)
+    {
+      std::cout << "usage: " << argv[0] << " [--check num_of_formulas] < input_file" << std::endl;
+      exit(0);
+    }
+  
   unsigned num_of_vars;
   std::vector<clause> f;
   
@@ -77,15 +355,21 @@ int main()
       exit(1);
     }
 
-  unsigned count = 0;
+  // Svaka kocka se broji sa svim svojim modelima
+  unsigned long count = 0;
   solver sl(num_of_vars);
-  
-  sl.initialize_solver(f, 0);
+  sl.reset_solver();
+  sl.add_clauses(f, true);
+  sl.initialize_solver();
   
   while(sl.solve())
     {
       sl.val().print(std::cout);
-      count++;
+      unsigned num_of_free = 0;
+      for(variable v = 0; v < num_of_vars; v++)
+	if(sl.val().variable_value(v) == B_UNDEFINED)
+	  num_of_free++;
+      count += 1ul << num_of_free;
     }
   std::cerr << "COUNT: " << count << std::endl;
   return 0;
@@ -1,6 +1,8 @@
 #include <iostream>
 #include <fstream>
 #include <cstring>
+#include <random>
+#include <memory>
 #include "dpll.hpp"
 
 using namespace std;
@@ -67,6 +69,216 @@ bool readDIMACS(std::vector<clause> & f, unsigned & num_of_vars, istream & istr)
   return true;
 }
 
+/* Provera resavaca (opcija --check): na slucajnim formulama sa
+   kontekstima, at-most-one ogranicenjima, nogood klauzama, kockama i
+   deljenjem pretrage, nabrojani modeli se porede sa modelima koji se
+   dobijaju iscrpnom pretragom. Model se kodira brojem u kome je
+   varijabla 0 najvisi bit, pa resavac nabraja modele u rastucem
+   poretku kodova. */
+
+bool is_true(literal l, unsigned code, unsigned n)
+{
+  return (((code >> (n - 1 - var_from_lit(l))) & 1) != 0) == is_positive(l);
+}
+
+bool satisfies(const clause & cl, unsigned code, unsigned n)
+{
+  for(literal l : cl)
+    if(is_true(l, code, n))
+      return true;
+  return false;
+}
+
+bool satisfies_amo(const clause & amo, unsigned code, unsigned n)
+{
+  unsigned count = 0;
+  for(literal l : amo)
+    if(is_true(l, code, n))
+      count++;
+  return count <= 1;
+}
+
+clause random_clause(std::mt19937 & gen, unsigned n, unsigned size)
+{
+  std::vector<variable> vars(n);
+  for(unsigned v = 0; v < n; v++)
+    vars[v] = v;
+  std::shuffle(vars.begin(), vars.end(), gen);
+  clause cl;
+  for(unsigned i = 0; i < size && i < n; i++)
+    cl.push_back(lit_from_var(vars[i], gen() % 2 ? P_POSITIVE : P_NEGATIVE));
+  return cl;
+}
+
+/* Jedna grana pretrage: resavac (polazni ili dobijen deljenjem),
+   njegove nogood klauze i kod poslednjeg modela */
+struct branch {
+  solver * sl;
+  std::unique_ptr<solver> snapshot;
+  std::vector<clause> nogoods;
+  long last = -1;
+};
+
+/* Nabraja sve modele (sa nogood klauzama i deljenjem) i poredi ih sa
+   modelima klauza i ogranicenja */
+bool check_enumeration(solver & sl, unsigned n, const std::vector<clause> & clauses,
+		       const std::vector<clause> & amos, std::mt19937 & gen, unsigned long & num_of_models)
+{
+  std::vector<bool> found(1u << n, false);
+  std::vector<branch> branches(1);
+  branches[0].sl = &sl;
+  
+  for(unsigned b = 0; b < branches.size(); b++)
+    while(branches[b].sl->solve())
+      {
+	solver & s = *branches[b].sl;
+	const valuation & val = s.val();
+	
+	// Razvijanje kocke
+	std::vector<variable> free;
+	unsigned base = 0;
+	for(variable v = 0; v < n; v++)
+	  if(val.variable_value(v) == B_UNDEFINED)
+	    free.push_back(v);
+	  else if(val.variable_value(v) == B_TRUE)
+	    base |= 1u << (n - 1 - v);
+
+	// Deljenje (i usred razvijanja kocke, kao kod generatora
+	// konfiguracija, gde ostatak kocke ostaje polaznoj grani)
+	long split_at = -1;
+	if(branches.size() < 8 && s.can_split() && gen() % 8 == 0)
+	  split_at = gen() % (1u << free.size());
+	
+	for(unsigned m = 0; m < (1u << free.size()); m++)
+	  {
+	    if((long)m == split_at)
+	      {
+		branch br;
+		br.snapshot = std::make_unique<solver>(s, solver::snapshot_tag());
+		br.sl = br.snapshot.get();
+		br.nogoods = branches[b].nogoods;
+		br.sl->take_unexplored_branch();
+		s.keep_current_branch();
+		branches.push_back(std::move(br));
+	      }
+	    
+	    unsigned code = base;
+	    for(unsigned i = 0; i < free.size(); i++)
+	      if((m >> (free.size() - 1 - i)) & 1)
+		code |= 1u << (n - 1 - free[i]);
+	    
+	    bool ok = !found[code] && (long)code > branches[b].last;
+	    for(const clause & cl : clauses)
+	      ok = ok && satisfies(cl, code, n);
+	    for(const clause & amo : amos)
+	      ok = ok && satisfies_amo(amo, code, n);
+	    for(const clause & ng : branches[b].nogoods)
+	      ok = ok && satisfies(ng, code, n);
+	    if(!ok)
+	      {
+		cerr << "wrong model " << code << " (branch " << b << ")" << endl;
+		return false;
+	      }
+	    found[code] = true;
+	    branches[b].last = code;
+	    num_of_models++;
+	  }
+
+	// Nogood klauza nad jednom do tri dodeljene varijable
+	std::vector<literal> assigned;
+	for(variable v = 0; v < n; v++)
+	  if(val.variable_value(v) != B_UNDEFINED)
+	    assigned.push_back(lit_from_var(v, val.variable_value(v) == B_TRUE ? P_NEGATIVE : P_POSITIVE));
+	if(!assigned.empty() && gen() % 4 == 0)
+	  {
+	    std::shuffle(assigned.begin(), assigned.end(), gen);
+	    assigned.resize(1 + gen() % std::min<unsigned>(3, assigned.size()));
+	    s.add_nogood(assigned);
+	    branches[b].nogoods.push_back(assigned);
+	  }
+      }
+
+  // Svaki model koji nije nabrojan mora biti odbacen nekom nogood
+  // klauzom
+  for(unsigned code = 0; code < (1u << n); code++)
+    {
+      if(found[code])
+	continue;
+      bool model = true;
+      for(const clause & cl : clauses)
+	model = model && satisfies(cl, code, n);
+      for(const clause & amo : amos)
+	model = model && satisfies_amo(amo, code, n);
+      bool blocked = false;
+      for(const branch & br : branches)
+	for(const clause & ng : br.nogoods)
+	  blocked = blocked || !satisfies(ng, code, n);
+      if(model && !blocked)
+	{
+	  cerr << "missing model " << code << endl;
+	  return false;
+	}
+    }
+  return true;
+}
+
+bool check_formula(unsigned seed, unsigned long & num_of_models)
+{
+  std::mt19937 gen(seed);
+  unsigned n = 3 + gen() % 10;
+  solver sl(n);
+  sl.set_cube_mode(gen() % 2);
+
+  std::vector<clause> base;
+  for(unsigned k = gen() % (2 * n); k > 0; k--)
+    base.push_back(random_clause(gen, n, 2 + gen() % 3));
+  sl.add_clauses(base);
+  sl.set_units();
+  sl.set_watch_lists();
+  sl.simplify_clauses();
+
+  // Klauze i ogranicenja otvorenih konteksta
+  std::vector<std::vector<clause>> contexts, contexts_amos;
+  for(unsigned round = 0; round < 8; round++)
+    {
+      unsigned k = contexts.empty() ? 0 : gen() % contexts.size();
+      sl.restore_clause_context(k);
+      contexts.resize(k);
+      contexts_amos.resize(k);
+      
+      for(unsigned c = 1 + gen() % 3; c > 0; c--)
+	{
+	  std::vector<clause> ctx, ctx_amos;
+	  for(unsigned i = gen() % n; i > 0; i--)
+	    ctx.push_back(random_clause(gen, n, 1 + gen() % 4));
+	  if(gen() % 3 == 0)
+	    ctx_amos.push_back(random_clause(gen, n, 2 + gen() % 3));
+	  sl.add_clause_context();
+	  sl.add_clauses(ctx);
+	  for(const clause & amo : ctx_amos)
+	    sl.add_at_most_one(amo);
+	  sl.set_last_context();
+	  contexts.push_back(ctx);
+	  contexts_amos.push_back(ctx_amos);
+	}
+      if(gen() % 2)
+	sl.simplify_clauses();
+
+      std::vector<clause> clauses = base, amos;
+      for(unsigned c = 0; c < contexts.size(); c++)
+	{
+	  clauses.insert(clauses.end(), contexts[c].begin(), contexts[c].end());
+	  amos.insert(amos.end(), contexts_amos[c].begin(), contexts_amos[c].end());
+	}
+      if(!check_enumeration(sl, n, clauses, amos, gen, num_of_models))
+	{
+	  cerr << "check failed: seed " << seed << ", round " << round << endl;
+	  return false;
+	}
+    }
+  return true;
+}
+
 
 int main(int argc, char ** argv)
 {
@@ -77,14 +289,19 @@ int main(int argc, char ** argv)
   std::ifstream file;
   bool print_solutions = true;
   bool all_sat = false;
+  unsigned num_of_checks = 0;
   
   for(unsigned i = 1; i < argc; i++)
     {
       if(strcmp(argv[i], "-h") == 0)
 	{
-	  std::cout << "usage: " << argv[0] << " [-h] [-n] [--all] [input_file]" << std::endl;
+	  std::cout << "usage: " << argv[0] << " [-h] [-n] [--all] [--check num_of_formulas] [input_file]" << std::endl;
 	  exit(0);
 	}
+      else if(strcmp(argv[i], "--check") == 0 && i + 1 < (unsigned)argc)
+	{
+	  num_of_checks = atoi(argv[++i]);
+	}
       else if(strcmp(argv[i], "-n") == 0)
 	{
 	  print_solutions = false;
@@ -105,6 +322,16 @@ int main(int argc, char ** argv)
 	}
     }      
   
+  if(num_of_checks > 0)
+    {
+      unsigned long num_of_models = 0;
+      for(unsigned seed = 0; seed < num_of_checks; seed++)
+	if(!check_formula(seed, num_of_models))
+	  exit(1);
+      cout << "CHECK OK: " << num_of_checks << " formulas, " << num_of_models << " models" << endl;
+      return 0;
+    }
+  
   if(istr == nullptr)
     istr = &cin;
   